@@ -0,0 +1,141 @@
+/**
+ \brief A small benchmark for the cost of NTrace statements in the calling thread.
+
+ Call with these command line options:
+
+  -n : number of iterations (default 10000000)
+
+ Each test runs the same loop; the time per iteration is printed in nanoseconds.
+ The messages go to an output that discards them, so only the cost for the
+ calling thread is measured.
+
+ The last tests measure the output side instead: formatting a message with a
+ Layout, and FileOutput writing it to /dev/null.
+ */
+
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../ntrace.h"
+#include "../ntrace/layout.h"
+
+TR_MODULE ("nbench");
+
+/// Output that throws everything away
+class NullOutput: public NTrace::IOutput
+{
+public:
+  virtual std::string getName () const
+  {
+    return "nbench.null_output";
+  }
+
+  virtual void saveMessage (const NTrace::Message &)
+  {
+  }
+};
+
+static volatile int s_sink = 0;
+static int s_evaluated = 0;
+
+// An argument that is expensive to compute; a disabled TR() should never call this
+static int expensive (int i)
+{
+  s_evaluated++;
+  return i * i;
+}
+
+static void traced_function (int i)
+{
+  TR_FUNC ("i = %d", expensive (i));
+  s_sink = i;
+}
+
+template <typename F>
+static void run (const char *name, long iterations, F func)
+{
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+  for (long i = 0; i < iterations; i++)
+  {
+    func ((int)i);
+  }
+  std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now ();
+  double ns = std::chrono::duration<double, std::nano> (end - start).count ();
+  std::cout << std::setw (40) << std::left << name << std::right << std::setw (10) << std::fixed << std::setprecision (2) << ns / iterations << " ns/call" << std::endl;
+}
+
+int main (int argc, char *argv[])
+{
+  long iterations = 10000000;
+  int opt = 0;
+
+  while ((opt = getopt (argc, argv, "n:")) != -1)
+  {
+    switch (opt)
+    {
+      case 'n':
+        iterations = atol (optarg);
+        break;
+      default:
+        std::cout << "Usage: nbench [-n iterations]" << std::endl;
+        exit (1);
+        break;
+    }
+  }
+
+  NTrace::IManager *mgr = NTrace::IManager::instance ();
+  NTrace::IModule *module = mgr->findModule ("nbench");
+  mgr->addOutput (new NullOutput ());
+
+  run ("empty loop", iterations, [] (int i) { s_sink = i; });
+
+  module->setLevel (NTrace::Notice);
+  module->setFunctionTracking (false);
+  run ("TR, level disabled", iterations, [] (int i) { TR (NTrace::Debug, "i = %d", expensive (i)); s_sink = i; });
+  run ("TR_FUNC, tracking disabled", iterations, [] (int i) { traced_function (i); });
+  if (s_evaluated != 0)
+  {
+    std::cout << "Error: arguments of disabled statements were evaluated " << s_evaluated << " times" << std::endl;
+  }
+
+  // Enabled statements are a lot slower; keep the run time reasonable
+  iterations /= 10;
+  module->setLevel (NTrace::Debug);
+  module->setFunctionTracking (true);
+  run ("TR, enabled", iterations, [] (int i) { TR (NTrace::Debug, "i = %d", i); });
+  run ("TR_FUNC, enabled", iterations, [] (int i) { traced_function (i); });
+
+  mgr->setDeferredFormatting (true);
+  run ("TR, enabled, deferred formatting", iterations, [] (int i) { TR (NTrace::Debug, "i = %d", i); });
+  mgr->setDeferredFormatting (false);
+
+  mgr->setQueueMode (NTrace::IManager::ThreadQueues);
+  run ("TR, enabled, thread queues", iterations, [] (int i) { TR (NTrace::Debug, "i = %d", i); });
+
+  if (mgr->setClockSource (NTrace::IManager::TscClock))
+  {
+    run ("TR, enabled, thread queues, TSC", iterations, [] (int i) { TR (NTrace::Debug, "i = %d", i); });
+    mgr->setClockSource (NTrace::IManager::SystemClock);
+  }
+
+  NTrace::Message msg;
+  msg.pid = getpid ();
+  msg.type = NTrace::Message::Normal;
+  msg.message = "a message of a typical length, with a number: 12345";
+  msg.timestamp = NTrace::Timestamp::now (NTrace::Timestamp::Monotonic);
+  std::string line;
+  NTrace::Layout file_layout ("(%pid) [%utc.ms] %msg", NTrace::Timestamp (0, 0));
+  run ("Layout, FileOutput pattern", iterations, [&] (int) { line.clear (); file_layout.format (msg, line); });
+  NTrace::Layout debug_layout ("(%pid) [%rel.ms] %indent%msg", msg.timestamp);
+  run ("Layout, DebugOutput pattern", iterations, [&] (int) { line.clear (); debug_layout.format (msg, line); });
+  NTrace::FileOutput *null_file = new NTrace::FileOutput ("/dev/null", "");
+  run ("FileOutput, to /dev/null", iterations, [&] (int) { null_file->saveMessage (msg); });
+  delete null_file;
+
+  NTrace::IManager::shutdown ();
+  return 0;
+}
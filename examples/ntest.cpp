@@ -5,6 +5,18 @@
 
   -d : show debug output
   -f : use file logging (optional filename, defaults to 'ntest.log')
+  -t : use per-thread message queues
+  -p : postpone formatting to the output thread
+  -w : give each output its own thread
+  -m : write the log file through a memory mapping
+  -b : buffer the log file for up to 100 ms
+  -u : write the log file through io_uring
+  -z : gzip rotated log files
+  -s : print statistics of the function durations at the end
+  -g : write a profile in folded stacks format to 'ntest.folded'
+  -k : write a callgrind profile to 'ntest.callgrind'
+  -c : write a Chrome trace to 'ntest.json'
+  -r : write a binary log file to 'ntest.bin'; read it with ntrace-decode
 
  */
 
@@ -29,6 +41,22 @@ static void help (const char *msg)
   std::cout << "                The file rotates after 1 kilobyte (1024 bytes) and keeps 5" << std::endl;
   std::cout << "                versions of the log files; older ones are removed." << std::endl;
   std::cout << "  -ln           Initial debug level (n = 0 to 7, 7 being most talkative)." << std::endl;
+  std::cout << "  -t            Use a lock-free message queue per thread." << std::endl;
+  std::cout << "  -p            Postpone formatting of messages to the output thread." << std::endl;
+  std::cout << "  -w            Give each output its own thread and queue." << std::endl;
+  std::cout << "  -m            Write the log file through a memory mapping." << std::endl;
+  std::cout << "  -b            Keep up to 64 kilobytes of log text for up to 100 ms" << std::endl;
+  std::cout << "                before writing it to the file." << std::endl;
+  std::cout << "  -u            Write the log file through io_uring (Linux)." << std::endl;
+  std::cout << "  -z            Compress rotated log files with gzip." << std::endl;
+  std::cout << "  -s            Print the call count and durations of the traced functions" << std::endl;
+  std::cout << "                at the end." << std::endl;
+  std::cout << "  -g            Write a profile of the traced functions as folded stacks," << std::endl;
+  std::cout << "                for flamegraph.pl or speedscope, to <filename>.folded." << std::endl;
+  std::cout << "  -k            Write a callgrind profile, for KCachegrind, to <filename>.callgrind." << std::endl;
+  std::cout << "  -c            Write a trace for Perfetto or chrome://tracing to <filename>.json." << std::endl;
+  std::cout << "  -r            Write a binary log file to <filename>.bin; convert it to text" << std::endl;
+  std::cout << "                with ntrace-decode." << std::endl;
 }
 
 
@@ -126,11 +154,23 @@ int main (int argc, char *argv[])
 {
   bool enable_debug = false;
   bool enable_file = false;
+  bool thread_queues = false;
+  bool deferred_formatting = false;
+  bool output_threads = false;
+  bool mapped_file = false;
+  bool buffered_file = false;
+  bool uring_file = false;
+  bool compress_files = false;
+  bool function_statistics = false;
+  bool folded_profile = false;
+  bool callgrind_profile = false;
+  bool chrome_trace = false;
+  bool binary_file = false;
   int debug_level = -1; // optional debug level to set
   std::string filename = "ntest";
   int opt = 0;
 
-  while ((opt = getopt (argc, argv, "df::l:")) != -1)
+  while ((opt = getopt (argc, argv, "df::l:tpwmbuzsgkcr")) != -1)
   {
     switch (opt)
     {
@@ -147,6 +187,42 @@ int main (int argc, char *argv[])
       case 'l':
         debug_level = atoi (optarg);
         break;
+      case 't':
+        thread_queues = true;
+        break;
+      case 'p':
+        deferred_formatting = true;
+        break;
+      case 'w':
+        output_threads = true;
+        break;
+      case 'm':
+        mapped_file = true;
+        break;
+      case 'b':
+        buffered_file = true;
+        break;
+      case 'u':
+        uring_file = true;
+        break;
+      case 'z':
+        compress_files = true;
+        break;
+      case 's':
+        function_statistics = true;
+        break;
+      case 'g':
+        folded_profile = true;
+        break;
+      case 'k':
+        callgrind_profile = true;
+        break;
+      case 'c':
+        chrome_trace = true;
+        break;
+      case 'r':
+        binary_file = true;
+        break;
       case ':':
         help ("Missing argument");
         exit (1);
@@ -158,13 +234,24 @@ int main (int argc, char *argv[])
     }
   }
 
-  if (enable_debug == false && enable_file == false)
+  if (enable_debug == false && enable_file == false && function_statistics == false &&
+    folded_profile == false && callgrind_profile == false && chrome_trace == false &&
+    binary_file == false)
   {
     help ("Error: no argument given");
     exit (1);
   }
 
   NTrace::IManager *ntrace_mgr = NTrace::IManager::instance ();
+  if (thread_queues)
+  {
+    ntrace_mgr->setQueueMode (NTrace::IManager::ThreadQueues);
+  }
+  ntrace_mgr->setDeferredFormatting (deferred_formatting);
+  if (output_threads)
+  {
+    ntrace_mgr->setDeliveryMode (NTrace::IManager::OutputThreads);
+  }
   if (enable_debug)
   {
     ntrace_mgr->enableDebugOutput ();
@@ -172,8 +259,45 @@ int main (int argc, char *argv[])
   if (enable_file)
   {
     NTrace::FileOutput *fo = new NTrace::FileOutput (filename, ".log", 1024, 5);
+    if (mapped_file)
+    {
+      fo->setWriteMode (NTrace::FileOutput::MappedWrite);
+    }
+    if (uring_file && !fo->setWriteMode (NTrace::FileOutput::UringWrite))
+    {
+      std::cout << "io_uring is not available; using the default write mode" << std::endl;
+    }
+    if (compress_files && !fo->setCompression (NTrace::FileOutput::GzipCompression))
+    {
+      std::cout << "gzip is not available; rotated files are not compressed" << std::endl;
+    }
+    if (buffered_file)
+    {
+      fo->setFlushPolicy (64 * 1024, 100);
+    }
     ntrace_mgr->addOutput (fo);
   }
+  if (function_statistics)
+  {
+    // Prints its table when it is destroyed by shutdown()
+    ntrace_mgr->addOutput (new NTrace::HistogramOutput (&std::cout));
+  }
+  if (folded_profile)
+  {
+    ntrace_mgr->addOutput (new NTrace::ProfileOutput (filename + ".folded", NTrace::ProfileOutput::FoldedStacks));
+  }
+  if (callgrind_profile)
+  {
+    ntrace_mgr->addOutput (new NTrace::ProfileOutput (filename + ".callgrind", NTrace::ProfileOutput::Callgrind));
+  }
+  if (chrome_trace)
+  {
+    ntrace_mgr->addOutput (new NTrace::ChromeTraceOutput (filename + ".json"));
+  }
+  if (binary_file)
+  {
+    ntrace_mgr->addOutput (new NTrace::BinaryFileOutput (filename + ".bin"));
+  }
 
   NTrace::IModule *this_module = ntrace_mgr->findModule ("ntest");
   if (this_module && debug_level >= 0)
@@ -4,8 +4,12 @@
 #include "ntrace/interfaces.h"
 #include "ntrace/function.h"
 
+#include "ntrace/outputs/binary_file_output.h"
+#include "ntrace/outputs/chrome_trace_output.h"
 #include "ntrace/outputs/debug_output.h"
 #include "ntrace/outputs/file_output.h"
+#include "ntrace/outputs/histogram_output.h"
+#include "ntrace/outputs/profile_output.h"
 
 // Define this macro in your project settings to enable the full set of TR macros.
 // This should normally only be done for your debug build
@@ -26,10 +30,17 @@
 
   #define TR_MODULE(name) static NTrace::IModule *s_trace_module = NTrace::IManager::instance()->registerModule(name)
 
-  #define TR_FUNC     NTrace::Function TracerObject(s_trace_module, FUNCNAME); TracerObject
-  #define TR          s_trace_module->log
-  #define TR_ERR      s_trace_module->error
-  #define TR_OUT      s_trace_module->out
+  // Every statement gets a static, constant initialized NTrace::CallSite; messages only carry a pointer to it.
+  #define NTRACE_EXPAND(x) x
+  #define NTRACE_FIRST_(first, ...) first
+  #define NTRACE_FIRST(...) NTRACE_EXPAND(NTRACE_FIRST_(__VA_ARGS__, 0))
+  #define NTRACE_SITE(name, fmt) static const NTrace::CallSite name = { __FILE__, __LINE__, FUNCNAME, NTrace::CallSite::literal (fmt), &s_trace_module }
+
+  // Disabled statements are filtered inline on the module's gate word, before any argument is evaluated.
+  #define TR_FUNC     NTRACE_SITE(ntrace_func_site, nullptr); NTrace::Function TracerObject(&ntrace_func_site); if (TracerObject.isEnabled ()) TracerObject
+  #define TR(level, ...) do { if ((level) <= s_trace_module->fastLevel ()) { NTRACE_SITE(ntrace_site, NTRACE_FIRST(__VA_ARGS__)); s_trace_module->log (&ntrace_site, level, __VA_ARGS__); } } while (0)
+  #define TR_ERR(...) do { NTRACE_SITE(ntrace_site, NTRACE_FIRST(__VA_ARGS__)); s_trace_module->error (&ntrace_site, __VA_ARGS__); } while (0)
+  #define TR_OUT(...) do { NTRACE_SITE(ntrace_site, NTRACE_FIRST(__VA_ARGS__)); s_trace_module->out (&ntrace_site, __VA_ARGS__); } while (0)
 
 #else
 
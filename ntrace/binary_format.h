@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace NTrace
+{
+
+/**
+  \brief Layout of the files written by BinaryFileOutput
+
+  A file starts with the 4 bytes "NTRB" and a version byte, followed by records.
+  Every record is a varint with the length of the rest of the record, a byte
+  with the record type and the fields of that type; unknown record types can be
+  skipped. Integers are unsigned LEB128 varints; signed values are zigzag
+  encoded first.
+
+  - ClockRecord: zigzag offset from the monotonic clock to the wall clock, in ns.
+    Written at the start of the file and whenever the offset changes.
+  - ModuleRecord: varint module ID, then the module name.
+  - FunctionRecord: varint function ID, then the function name.
+  - ThreadRecord: varint pid, varint tid, then the thread name.
+  - MessageRecord: zigzag difference with the timestamp of the previous message
+    (monotonic ns; the first is relative to 0), varint pid, varint tid, zigzag
+    level, varint type, varint module ID (0 if none), varint function ID (0 if
+    none), then the text of the message (the arguments for an Entry message).
+
+  Module, function and thread names are written once per file, before the first
+  message that refers to them. Names and text are not terminated; they take up
+  the rest of the record.
+*/
+class BinaryFormat
+{
+public:
+  enum RecordType
+  {
+    ClockRecord = 1,
+    ModuleRecord = 2,
+    FunctionRecord = 3,
+    ThreadRecord = 4,
+    MessageRecord = 5
+  };
+
+  static const char *magic ()
+  {
+    return "NTRB";
+  }
+  static const size_t s_magicLength = 4;
+  static const unsigned char s_version = 1;
+
+  /// Longest possible varint
+  static const size_t s_maxVarint = 10;
+
+  /// Append \p value as a varint
+  static void putVarint (std::string &out, uint64_t value)
+  {
+    while (value >= 0x80)
+    {
+      out += (char)(value | 0x80);
+      value >>= 7;
+    }
+    out += (char)value;
+  }
+
+  /// Append \p value zigzag encoded
+  static void putSigned (std::string &out, int64_t value)
+  {
+    putVarint (out, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+  }
+
+  /**
+   \brief Read a varint
+   \param p Start of the varint; moved past it
+   \param end End of the data
+   \param value Receives the value
+   \return false if the data ends before the varint does
+   */
+  static bool getVarint (const unsigned char *&p, const unsigned char *end, uint64_t &value)
+  {
+    value = 0;
+    for (unsigned int shift = 0; p < end && shift < 64; shift += 7)
+    {
+      unsigned char byte = *p++;
+      value |= (uint64_t)(byte & 0x7f) << shift;
+      if (0 == (byte & 0x80))
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /// Read a zigzag encoded value
+  static bool getSigned (const unsigned char *&p, const unsigned char *end, int64_t &value)
+  {
+    uint64_t raw = 0;
+    if (!getVarint (p, end, raw))
+    {
+      return false;
+    }
+    value = (int64_t)(raw >> 1) ^ -(int64_t)(raw & 1);
+    return true;
+  }
+};
+
+} // namespace
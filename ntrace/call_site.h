@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace NTrace
+{
+
+class IModule;
+
+/**
+  \brief Static description of a single TR(), TR_ERR(), TR_OUT() or TR_FUNC() statement
+
+  The TR macros create one of these per statement, as a static constant that the
+  compiler initializes at build time. Messages only carry a pointer to it, so the file,
+  line, function name and format string never have to be copied; outputs can look
+  them up when they need them (see the %file and %line fields of Layout). The level
+  is not part of it, since it need not be a constant. The function name is registered with
+  IManager::registerFunction() the first time a TR_FUNC() statement fires.
+*/
+struct CallSite
+{
+  const char *file;       ///< Source file name (__FILE__)
+  int line;               ///< Line number of the statement
+  const char *function;   ///< Function name, as given by FUNCNAME
+  const char *format;     ///< Format string if it is a string literal; null otherwise
+  IModule *const *module; ///< Points to the s_trace_module variable of the source file
+  /// ID of \ref function in the function name table; filled in on first use
+  mutable std::atomic<uint32_t> functionId {0};
+
+  /// Returns the format string of a statement that passes a string literal
+  template <size_t N>
+  static constexpr const char *literal (const char (&fmt)[N])
+  {
+    return fmt;
+  }
+
+  /// A format in a character array that is not constant may change or go away
+  template <size_t N>
+  static constexpr const char *literal (char (&)[N])
+  {
+    return nullptr;
+  }
+
+  /// Neither is a format that is passed by pointer known to stay valid; taken by
+  /// reference, so arrays do not decay to this overload
+  template <typename T>
+  static constexpr const char *literal (T *const &)
+  {
+    return nullptr;
+  }
+
+  /// TR_FUNC() statements have no format
+  static constexpr const char *literal (std::nullptr_t)
+  {
+    return nullptr;
+  }
+
+  /// Statements that log a std::string have no static format
+  static const char *literal (const std::string &)
+  {
+    return nullptr;
+  }
+};
+
+} // namespace
@@ -0,0 +1,124 @@
+#include "call_tree.h"
+
+using namespace NTrace;
+
+/**
+  \brief Constructor
+  \param max_nodes Maximum number of distinct call paths
+ */
+CallTree::CallTree (size_t max_nodes)
+  : m_maxNodes (max_nodes), m_truncated (0)
+{
+}
+
+/**
+  \brief A thread entered a function
+ */
+void CallTree::enter (int tid, uint32_t function_id, const Timestamp &when)
+{
+  std::vector<Frame> &stack = m_stacks[tid];
+  if (stack.size () >= s_maxDepth)
+  {
+    // The oldest calls will never see their Exit; forget them
+    stack.erase (stack.begin ());
+  }
+
+  uint32_t parent = stack.empty () ? s_root : stack.back ().node;
+  uint32_t node = s_root;
+  if (!stack.empty () && s_root == parent)
+  {
+    // The caller has no node, so neither have its callees
+    m_truncated++;
+  }
+  else
+  {
+    node = findNode (parent, function_id);
+  }
+
+  Frame frame = { node, function_id, when, 0 };
+  stack.push_back (frame);
+}
+
+/**
+  \brief A thread left a function
+
+  Calls above the matching Entry lost their Exit and are discarded; an Exit
+  without an Entry is ignored.
+ */
+void CallTree::exit (int tid, uint32_t function_id, const Timestamp &when)
+{
+  std::unordered_map<int, std::vector<Frame>>::iterator it = m_stacks.find (tid);
+  if (it == m_stacks.end ())
+  {
+    return;
+  }
+  std::vector<Frame> &stack = it->second;
+  for (size_t i = stack.size (); i > 0; i--)
+  {
+    Frame &frame = stack[i - 1];
+    if (frame.functionId != function_id)
+    {
+      continue;
+    }
+
+    int64_t duration = when - frame.entry;
+    if (duration < 0)
+    {
+      duration = 0;
+    }
+    if (frame.node != s_root)
+    {
+      Node &node = m_nodes[frame.node];
+      node.calls++;
+      node.inclusive += duration;
+      node.exclusive += duration > frame.children ? duration - frame.children : 0;
+      if (i > 1)
+      {
+        stack[i - 2].children += duration;
+      }
+    }
+    // else: without a node of its own, the time stays with the caller
+    stack.resize (i - 1);
+    break;
+  }
+  if (stack.empty ())
+  {
+    m_stacks.erase (it);
+  }
+}
+
+/**
+  \brief Forget all nodes and open calls
+ */
+void CallTree::reset ()
+{
+  m_nodes.clear ();
+  m_index.clear ();
+  m_stacks.clear ();
+  m_truncated = 0;
+}
+
+/**
+  \brief Return the node for a call, creating it if needed
+  \return Index of the node, or s_root if the tree is full
+ */
+uint32_t CallTree::findNode (uint32_t parent, uint32_t function_id)
+{
+  uint64_t key = (static_cast<uint64_t> (parent) << 32) | function_id;
+  std::unordered_map<uint64_t, uint32_t>::const_iterator it = m_index.find (key);
+  if (it != m_index.end ())
+  {
+    return it->second;
+  }
+  if (m_nodes.size () >= m_maxNodes)
+  {
+    m_truncated++;
+    return s_root;
+  }
+
+  Node node = { function_id, parent, 0, 0, 0 };
+  uint32_t index = static_cast<uint32_t> (m_nodes.size ());
+  m_nodes.push_back (node);
+  m_index[key] = index;
+  return index;
+}
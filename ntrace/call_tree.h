@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "timestamp.h"
+
+namespace NTrace
+{
+
+/**
+  \brief Call paths rebuilt from Entry and Exit messages, with their times
+
+  Every distinct path from a thread's outermost traced function down to a
+  function gets a node, which holds the number of calls along that path and
+  their inclusive and exclusive (self) time in nanoseconds. The paths of all
+  threads are merged.
+
+  The number of nodes is limited. Once the limit is reached, calls along paths
+  that are not in the tree yet are counted as time of their caller.
+
+  Not thread-safe.
+*/
+class CallTree
+{
+public:
+  struct Node
+  {
+    uint32_t functionId;
+    uint32_t parent;    ///< Index of the caller's node; s_root for outermost functions
+    uint64_t calls;
+    uint64_t inclusive; ///< Nanoseconds, including called functions
+    uint64_t exclusive; ///< Nanoseconds spent in the function itself
+  };
+
+  /// Parent of the outermost functions
+  static const uint32_t s_root = 0xffffffff;
+
+  explicit CallTree (size_t max_nodes);
+
+  void enter (int tid, uint32_t function_id, const Timestamp &when);
+  void exit (int tid, uint32_t function_id, const Timestamp &when);
+  void reset ();
+
+  /// All nodes; a parent always comes before its children
+  const std::vector<Node> &getNodes () const
+  {
+    return m_nodes;
+  }
+
+  /// Number of calls that were not given a node because the tree was full
+  unsigned long getTruncated () const
+  {
+    return m_truncated;
+  }
+
+private:
+  /// A function that has been entered but not yet left
+  struct Frame
+  {
+    uint32_t node;       ///< s_root if the call has no node
+    uint32_t functionId;
+    Timestamp entry;
+    int64_t children;    ///< Time spent in calls made from this one
+  };
+
+  /// Maximum call depth kept per thread; protects against Exits that were dropped
+  static const size_t s_maxDepth = 256;
+
+  uint32_t findNode (uint32_t parent, uint32_t function_id);
+
+  size_t m_maxNodes;
+  std::vector<Node> m_nodes;
+  std::unordered_map<uint64_t, uint32_t> m_index; ///< (parent, function ID) to node
+  std::unordered_map<int, std::vector<Frame>> m_stacks; ///< Open calls per thread ID
+  unsigned long m_truncated;
+};
+
+} // namespace
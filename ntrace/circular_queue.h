@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace NTrace
+{
+
+/**
+  \brief Fixed size FIFO queue that overwrites its oldest item when full
+
+  All slots are created up front and items are moved in and out, so once the
+  slots have grown to their working size, pushing and popping never allocate.
+  The capacity is rounded up to the next power of 2.
+
+  Not thread-safe; the caller must provide locking.
+*/
+template <typename T>
+class CircularQueue
+{
+public:
+  /**
+   \brief Constructor
+   \param capacity Minimum number of items the queue can hold
+   */
+  explicit CircularQueue (size_t capacity)
+    : m_head (0), m_tail (0)
+  {
+    size_t size = 1;
+    while (size < capacity)
+    {
+      size <<= 1;
+    }
+    m_slots.resize (size);
+    m_mask = size - 1;
+  }
+
+  /**
+   \brief Move item to the end of the queue
+   \return false if the queue was full and the oldest item was dropped to make room
+   */
+  bool push (T &&item)
+  {
+    bool room = true;
+    if (m_head - m_tail > m_mask)
+    {
+      m_tail++;
+      room = false;
+    }
+    m_slots[m_head & m_mask] = std::move (item);
+    m_head++;
+    return room;
+  }
+
+  /**
+   \brief Move the oldest item out of the queue
+   \return false if the queue is empty
+   */
+  bool pop (T &item)
+  {
+    if (m_head == m_tail)
+    {
+      return false;
+    }
+    item = std::move (m_slots[m_tail & m_mask]);
+    m_tail++;
+    return true;
+  }
+
+  /**
+   \brief Call \p func with the items in the queue, oldest first
+   \param func Called as func (T *begin, T *end) for each contiguous range; at most twice
+
+   The items stay in the queue; use clear() afterwards to drop them.
+   */
+  template <typename F>
+  void forEachRange (F func)
+  {
+    if (empty ())
+    {
+      return;
+    }
+    size_t first = m_tail & m_mask;
+    size_t last = m_head & m_mask;
+    if (first < last)
+    {
+      func (&m_slots[first], &m_slots[0] + last);
+    }
+    else
+    {
+      func (&m_slots[first], &m_slots[0] + m_slots.size ());
+      if (last > 0)
+      {
+        func (&m_slots[0], &m_slots[0] + last);
+      }
+    }
+  }
+
+  /**
+   \brief Forget all items
+
+   The slots keep their content until they are overwritten; the next push starts
+   at the first slot again, so the items stay contiguous as long as the queue does
+   not overflow.
+   */
+  void clear ()
+  {
+    m_head = 0;
+    m_tail = 0;
+  }
+
+  /// Exchange the content of two queues; does not copy or move any items
+  void swap (CircularQueue &other)
+  {
+    m_slots.swap (other.m_slots);
+    std::swap (m_mask, other.m_mask);
+    std::swap (m_head, other.m_head);
+    std::swap (m_tail, other.m_tail);
+  }
+
+  bool empty () const
+  {
+    return m_head == m_tail;
+  }
+
+  size_t size () const
+  {
+    return m_head - m_tail;
+  }
+
+  size_t capacity () const
+  {
+    return m_mask + 1;
+  }
+
+private:
+  std::vector<T> m_slots;
+  size_t m_mask;
+  size_t m_head; ///< Next slot to write
+  size_t m_tail; ///< Oldest item
+};
+
+} // namespace
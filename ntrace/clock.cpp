@@ -0,0 +1,158 @@
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+#include "clock.h"
+
+using namespace NTrace;
+
+std::atomic<bool> Clock::s_tscEnabled (false);
+
+namespace
+{
+
+/// Length of the initial frequency measurement
+const int64_t s_calibrationNanos = 2000000;
+
+int64_t monotonicNanos ()
+{
+  return Timestamp::now (Timestamp::Monotonic).getNanos ();
+}
+
+bool detectInvariantTsc ()
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+  int regs[4];
+  __cpuid (regs, 0x80000000);
+  if ((unsigned int)regs[0] < 0x80000007)
+  {
+    return false;
+  }
+  __cpuid (regs, 0x80000007);
+  return 0 != (regs[3] & (1 << 8));
+#elif defined(__x86_64__) || defined(__i386__)
+  unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+  if (__get_cpuid_max (0x80000000, nullptr) < 0x80000007)
+  {
+    return false;
+  }
+  __get_cpuid (0x80000007, &eax, &ebx, &ecx, &edx);
+  return 0 != (edx & (1 << 8));
+#else
+  return false;
+#endif
+}
+
+} // namespace
+
+/**
+  \brief Check if the CPU has an invariant TSC
+
+  Asks the CPU once (cpuid leaf 0x80000007) and remembers the answer. Always
+  false on non-x86 systems.
+ */
+bool Clock::haveInvariantTsc ()
+{
+  static const bool s_invariant = detectInvariantTsc ();
+  return s_invariant;
+}
+
+/**
+  \brief Switch between the TSC and the system clock
+  \return false if the TSC was requested but is not suitable; the system clock stays in use
+ */
+bool Clock::setTscEnabled (bool enable)
+{
+  if (enable && !haveInvariantTsc ())
+  {
+    return false;
+  }
+  s_tscEnabled.store (enable, std::memory_order_relaxed);
+  return true;
+}
+
+/**
+  \brief Read the time stamp counter
+
+  Returns 0 if there is no TSC.
+ */
+uint64_t Clock::readTsc ()
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+  return __rdtsc ();
+#elif defined(__x86_64__) || defined(__i386__)
+  return __rdtsc ();
+#else
+  return 0;
+#endif
+}
+
+/**
+  \brief Return a timestamp for the current time from the selected source
+
+  Returns a monotonic timestamp; with the TSC enabled this is a raw timestamp
+  that must be converted before use.
+ */
+Timestamp Clock::now ()
+{
+  if (tscEnabled ())
+  {
+    return Timestamp::fromTicks (readTsc ());
+  }
+  return Timestamp::now (Timestamp::Monotonic);
+}
+
+/***************************************************************************/
+
+/**
+  \brief Constructor
+
+  Measures the TSC frequency over a short interval (about 2 ms); the result is
+  good enough to start with and improves with each call to recalibrate().
+ */
+TscCalibration::TscCalibration ()
+{
+  m_firstNanos = monotonicNanos ();
+  m_firstTicks = Clock::readTsc ();
+
+  int64_t nanos;
+  uint64_t ticks;
+  do
+  {
+    nanos = monotonicNanos ();
+    ticks = Clock::readTsc ();
+  } while (nanos - m_firstNanos < s_calibrationNanos);
+
+  m_nanosPerTick = (ticks > m_firstTicks) ? (double)(nanos - m_firstNanos) / (double)(ticks - m_firstTicks) : 1.0;
+  m_anchorNanos = monotonicNanos ();
+  m_anchorTicks = Clock::readTsc ();
+}
+
+/**
+  \brief Refine the TSC frequency and take a new reference point
+ */
+void TscCalibration::recalibrate ()
+{
+  int64_t nanos = monotonicNanos ();
+  uint64_t ticks = Clock::readTsc ();
+  if (ticks > m_firstTicks && nanos > m_firstNanos)
+  {
+    m_nanosPerTick = (double)(nanos - m_firstNanos) / (double)(ticks - m_firstTicks);
+  }
+  m_anchorNanos = monotonicNanos ();
+  m_anchorTicks = Clock::readTsc ();
+}
+
+/**
+  \brief Convert a raw TSC value to a monotonic timestamp
+  \param ticks TSC value; may be from before the last recalibration
+ */
+Timestamp TscCalibration::convert (uint64_t ticks) const
+{
+  int64_t delta = (int64_t)(ticks - m_anchorTicks);
+  int64_t nanos = m_anchorNanos + (int64_t)((double)delta * m_nanosPerTick);
+  return Timestamp::fromNanos (nanos, Timestamp::Monotonic);
+}
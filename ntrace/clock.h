@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "timestamp.h"
+
+namespace NTrace
+{
+
+/**
+  \brief Source of message timestamps
+
+  By default every message asks the system for the current time. Alternatively
+  the CPU time stamp counter (TSC) can be used: reading it takes a few nanoseconds
+  and no system call. The message then carries the raw counter value, which the
+  output thread converts to a monotonic time with a TscCalibration.
+
+  The TSC is only used when the CPU reports an invariant TSC, i.e. one that runs
+  at a constant rate in all power states and on all cores.
+
+  Timestamps are taken from the monotonic clock either way; see Timestamp.
+*/
+class Clock
+{
+public:
+  static bool haveInvariantTsc ();
+  static bool setTscEnabled (bool enable);
+
+  /// Returns true if new timestamps should be read from the TSC
+  static bool tscEnabled ()
+  {
+    return s_tscEnabled.load (std::memory_order_relaxed);
+  }
+
+  static uint64_t readTsc ();
+  static Timestamp now ();
+
+private:
+  static std::atomic<bool> s_tscEnabled;
+};
+
+/**
+  \brief Conversion from TSC values to monotonic time
+
+  Keeps a reference point (a TSC value and the monotonic time at that moment) and
+  the TSC frequency. The frequency is first estimated over a short interval and
+  refined every time recalibrate() is called, by measuring over the whole time
+  since construction; each recalibration also takes a new reference point, so
+  any drift between the two clocks stays small.
+
+  Not thread-safe; it is meant to be used by the output thread only.
+*/
+class TscCalibration
+{
+public:
+  TscCalibration ();
+
+  void recalibrate ();
+  Timestamp convert (uint64_t ticks) const;
+
+private:
+  uint64_t m_firstTicks;  ///< TSC at construction
+  int64_t m_firstNanos;   ///< Monotonic time at construction
+  uint64_t m_anchorTicks; ///< TSC at the last (re)calibration
+  int64_t m_anchorNanos;  ///< Monotonic time at the last (re)calibration
+  double m_nanosPerTick;
+};
+
+} // namespace
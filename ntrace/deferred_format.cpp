@@ -0,0 +1,521 @@
+/**
+  \brief Deferred printf() formatting
+
+  The captured arguments are stored as a sequence of raw values in the same order as
+  they appear in the format string; no type information is stored since the format
+  string itself describes the layout. Strings are stored as a 32-bit length followed by
+  the characters and a terminating zero, so they can be passed straight to printf().
+ */
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <wchar.h>
+
+#include "deferred_format.h"
+
+using namespace NTrace;
+
+namespace
+{
+
+/// Marks a null pointer passed for a %s conversion
+const uint32_t s_nullString = 0xffffffff;
+
+/// Type of the argument that belongs to a conversion
+enum ArgumentType
+{
+  NoArgument,
+  IntArgument,
+  LongArgument,
+  LongLongArgument,
+  IntMaxArgument,
+  SizeArgument,
+  PtrDiffArgument,
+  DoubleArgument,
+  LongDoubleArgument,
+  StringArgument,
+  WideStringArgument,
+  PointerArgument,
+  SkipArgument,
+  ErrnoArgument   ///< %m: no argument; strerror(errno) is captured as a string
+};
+
+/// A single conversion specification from a format string
+struct Conversion
+{
+  const char *end;      ///< Points just beyond the conversion character
+  int stars;            ///< Number of '*' width/precision arguments (0..2)
+  bool starPrecision;   ///< The precision is given by the last '*' argument
+  int precision;        ///< Literal precision; -1 if none was given
+  ArgumentType type;    ///< The argument itself
+};
+
+/**
+  \brief Parse one conversion specification
+  \param p Points to the '%' character
+
+  Walks past flags, width, precision and length modifiers. Unknown conversions
+  are treated as text without argument.
+ */
+Conversion parseConversion (const char *p)
+{
+  Conversion conv;
+  enum { LenNone, LenChar, LenShort, LenLong, LenLongLong, LenIntMax, LenSize, LenPtrDiff, LenLongDouble } length = LenNone;
+
+  conv.stars = 0;
+  conv.starPrecision = false;
+  conv.precision = -1;
+  conv.type = NoArgument;
+
+  p++; // skip '%'
+  while (*p && strchr ("-+ #0'", *p))
+  {
+    p++;
+  }
+  // width
+  if ('*' == *p)
+  {
+    conv.stars++;
+    p++;
+  }
+  while (*p >= '0' && *p <= '9')
+  {
+    p++;
+  }
+  // precision
+  if ('.' == *p)
+  {
+    p++;
+    if ('*' == *p)
+    {
+      conv.stars++;
+      conv.starPrecision = true;
+      p++;
+    }
+    else
+    {
+      // A '.' without digits means a precision of 0
+      conv.precision = 0;
+      while (*p >= '0' && *p <= '9')
+      {
+        conv.precision = conv.precision * 10 + (*p - '0');
+        p++;
+      }
+    }
+  }
+  // length modifier
+  switch (*p)
+  {
+    case 'h':
+      length = ('h' == p[1]) ? LenChar : LenShort;
+      p += (LenChar == length) ? 2 : 1;
+      break;
+    case 'l':
+      length = ('l' == p[1]) ? LenLongLong : LenLong;
+      p += (LenLongLong == length) ? 2 : 1;
+      break;
+    case 'q':
+      length = LenLongLong;
+      p++;
+      break;
+    case 'j':
+      length = LenIntMax;
+      p++;
+      break;
+    case 'z':
+      length = LenSize;
+      p++;
+      break;
+    case 't':
+      length = LenPtrDiff;
+      p++;
+      break;
+    case 'L':
+      length = LenLongDouble;
+      p++;
+      break;
+    case 'I': // Microsoft
+      if ('6' == p[1] && '4' == p[2])
+      {
+        length = LenLongLong;
+        p += 3;
+      }
+      else if ('3' == p[1] && '2' == p[2])
+      {
+        p += 3;
+      }
+      else
+      {
+        length = LenSize;
+        p++;
+      }
+      break;
+  }
+
+  switch (*p)
+  {
+    case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
+      switch (length)
+      {
+        case LenLong:     conv.type = LongArgument; break;
+        case LenLongLong: conv.type = LongLongArgument; break;
+        case LenIntMax:   conv.type = IntMaxArgument; break;
+        case LenSize:     conv.type = SizeArgument; break;
+        case LenPtrDiff:  conv.type = PtrDiffArgument; break;
+        default:          conv.type = IntArgument; break;
+      }
+      break;
+    case 'c': case 'C':
+      // chars and wide chars are promoted to int
+      conv.type = IntArgument;
+      break;
+    case 's':
+      conv.type = (LenLong == length) ? WideStringArgument : StringArgument;
+      break;
+    case 'S':
+      conv.type = WideStringArgument;
+      break;
+    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+      conv.type = (LenLongDouble == length) ? LongDoubleArgument : DoubleArgument;
+      break;
+    case 'p':
+      conv.type = PointerArgument;
+      break;
+    case 'n':
+      conv.type = SkipArgument;
+      break;
+    case 'm':
+      conv.type = ErrnoArgument;
+      break;
+    case '\0':
+      conv.end = p;
+      return conv;
+  }
+  conv.end = p + 1;
+  return conv;
+}
+
+template <typename T>
+void put (Payload &out, T value)
+{
+  out.append (reinterpret_cast<const char *> (&value), sizeof (T));
+}
+
+/// Read value from the blob; returns false if the blob is exhausted
+template <typename T>
+bool get (const Payload &data, size_t &pos, T &value)
+{
+  if (pos + sizeof (T) > data.size ())
+  {
+    return false;
+  }
+  memcpy (&value, data.data () + pos, sizeof (T));
+  pos += sizeof (T);
+  return true;
+}
+
+/// printf() into a string
+void appendFormat (std::string &out, const char *spec, ...)
+{
+  char buffer[256];
+  va_list args, copy;
+
+  va_start (args, spec);
+  va_copy (copy, args);
+  int len = vsnprintf (buffer, sizeof (buffer), spec, args);
+  if (len >= 0 && len < (int)sizeof (buffer))
+  {
+    out.append (buffer, len);
+  }
+  else if (len > 0)
+  {
+    size_t pos = out.size ();
+    out.resize (pos + len + 1);
+    vsnprintf (&out[pos], len + 1, spec, copy);
+    out.resize (pos + len);
+  }
+  va_end (copy);
+  va_end (args);
+}
+
+/// Format a single value, with its optional width and precision arguments
+template <typename T>
+void appendValue (std::string &out, const std::string &spec, int stars, const int *star_values, T value)
+{
+  switch (stars)
+  {
+    case 0:
+      appendFormat (out, spec.c_str (), value);
+      break;
+    case 1:
+      appendFormat (out, spec.c_str (), star_values[0], value);
+      break;
+    default:
+      appendFormat (out, spec.c_str (), star_values[0], star_values[1], value);
+      break;
+  }
+}
+
+/// Read a value from the blob and format it
+template <typename T>
+bool expandValue (std::string &out, const std::string &spec, int stars, const int *star_values, const Payload &data, size_t &pos)
+{
+  T value;
+  if (!get (data, pos, value))
+  {
+    return false;
+  }
+  appendValue (out, spec, stars, star_values, value);
+  return true;
+}
+
+} // namespace
+
+
+/**
+  \brief Copy arguments described by a format string into a binary blob
+  \param out Blob to append to
+  \param fmt printf() style format string
+  \param args Argument list; it is consumed by this function
+ */
+void DeferredFormat::capture (Payload &out, const char *fmt, va_list args)
+{
+  const char *p = fmt;
+  int saved_errno = errno;
+
+  while (nullptr != (p = strchr (p, '%')))
+  {
+    Conversion conv = parseConversion (p);
+    int precision = conv.precision;
+    for (int i = 0; i < conv.stars; i++)
+    {
+      int value = va_arg (args, int);
+      put (out, value);
+      if (conv.starPrecision && i == conv.stars - 1)
+      {
+        // A negative precision counts as none at all
+        precision = value < 0 ? -1 : value;
+      }
+    }
+    switch (conv.type)
+    {
+      case NoArgument:
+        break;
+      case IntArgument:
+        put (out, va_arg (args, int));
+        break;
+      case LongArgument:
+        put (out, va_arg (args, long));
+        break;
+      case LongLongArgument:
+        put (out, va_arg (args, long long));
+        break;
+      case IntMaxArgument:
+        put (out, va_arg (args, intmax_t));
+        break;
+      case SizeArgument:
+        put (out, va_arg (args, size_t));
+        break;
+      case PtrDiffArgument:
+        put (out, va_arg (args, ptrdiff_t));
+        break;
+      case DoubleArgument:
+        put (out, va_arg (args, double));
+        break;
+      case LongDoubleArgument:
+        put (out, va_arg (args, long double));
+        break;
+      case PointerArgument:
+        put (out, va_arg (args, void *));
+        break;
+      case SkipArgument:
+        va_arg (args, void *);
+        break;
+      case StringArgument:
+      {
+        const char *str = va_arg (args, const char *);
+        if (nullptr == str)
+        {
+          put (out, s_nullString);
+        }
+        else
+        {
+          // printf() reads no more than the precision; the string need not be terminated
+          uint32_t len = (uint32_t)(precision >= 0 ? strnlen (str, precision) : strlen (str));
+          put (out, len);
+          out.append (str, len);
+          out.append ("", 1);
+        }
+        break;
+      }
+      case ErrnoArgument:
+      {
+        const char *str = strerror (saved_errno);
+        uint32_t len = (uint32_t)strlen (str);
+        put (out, len);
+        out.append (str, len + 1);
+        break;
+      }
+      case WideStringArgument:
+      {
+        const wchar_t *str = va_arg (args, const wchar_t *);
+        if (nullptr == str)
+        {
+          put (out, s_nullString);
+        }
+        else
+        {
+          uint32_t len = (uint32_t)(precision >= 0 ? wcsnlen (str, precision) : wcslen (str));
+          const wchar_t zero = L'\0';
+          put (out, len);
+          out.append (reinterpret_cast<const char *> (str), len * sizeof (wchar_t));
+          out.append (reinterpret_cast<const char *> (&zero), sizeof (wchar_t));
+        }
+        break;
+      }
+    }
+    p = conv.end;
+  }
+}
+
+/**
+  \brief Format previously captured arguments
+  \param out String to append the formatted text to
+  \param fmt The same format string that was passed to capture()
+  \param data The blob produced by capture()
+ */
+void DeferredFormat::expand (std::string &out, const char *fmt, const Payload &data)
+{
+  const char *p = fmt;
+  const char *percent = nullptr;
+  size_t pos = 0;
+
+  while (nullptr != (percent = strchr (p, '%')))
+  {
+    out.append (p, percent - p);
+
+    Conversion conv = parseConversion (percent);
+    std::string spec (percent, conv.end);
+    int stars[2] = {0, 0};
+    bool ok = true;
+    for (int i = 0; i < conv.stars; i++)
+    {
+      ok = ok && get (data, pos, stars[i]);
+    }
+
+    switch (conv.type)
+    {
+      case NoArgument:
+        // Either '%%' or something we don't understand
+        if ("%%" == spec)
+        {
+          out += '%';
+        }
+        else
+        {
+          out += spec;
+        }
+        break;
+      case IntArgument:
+        ok = ok && expandValue<int> (out, spec, conv.stars, stars, data, pos);
+        break;
+      case LongArgument:
+        ok = ok && expandValue<long> (out, spec, conv.stars, stars, data, pos);
+        break;
+      case LongLongArgument:
+        ok = ok && expandValue<long long> (out, spec, conv.stars, stars, data, pos);
+        break;
+      case IntMaxArgument:
+        ok = ok && expandValue<intmax_t> (out, spec, conv.stars, stars, data, pos);
+        break;
+      case SizeArgument:
+        ok = ok && expandValue<size_t> (out, spec, conv.stars, stars, data, pos);
+        break;
+      case PtrDiffArgument:
+        ok = ok && expandValue<ptrdiff_t> (out, spec, conv.stars, stars, data, pos);
+        break;
+      case DoubleArgument:
+        ok = ok && expandValue<double> (out, spec, conv.stars, stars, data, pos);
+        break;
+      case LongDoubleArgument:
+        ok = ok && expandValue<long double> (out, spec, conv.stars, stars, data, pos);
+        break;
+      case PointerArgument:
+      {
+        void *value = nullptr;
+        ok = ok && get (data, pos, value);
+        if (ok) appendValue (out, spec, conv.stars, stars, value);
+        break;
+      }
+      case SkipArgument:
+        break;
+      case ErrnoArgument:
+        // Captured as a string; print it as one
+        spec[spec.size () - 1] = 's';
+        // fall through
+      case StringArgument:
+      {
+        uint32_t len = 0;
+        ok = ok && get (data, pos, len);
+        if (!ok)
+        {
+          break;
+        }
+        if (s_nullString == len)
+        {
+          appendValue (out, spec, conv.stars, stars, "(null)");
+        }
+        else if (pos + len + 1 <= data.size ())
+        {
+          appendValue (out, spec, conv.stars, stars, data.data () + pos);
+          pos += len + 1;
+        }
+        else
+        {
+          ok = false;
+        }
+        break;
+      }
+      case WideStringArgument:
+      {
+        uint32_t len = 0;
+        ok = ok && get (data, pos, len);
+        if (!ok)
+        {
+          break;
+        }
+        if (s_nullString == len)
+        {
+          appendValue (out, spec, conv.stars, stars, L"(null)");
+        }
+        else if (pos + (len + 1) * sizeof (wchar_t) <= data.size ())
+        {
+          // The blob is not aligned for wchar_t, so copy it out first
+          std::wstring str (len, L'\0');
+          memcpy (&str[0], data.data () + pos, len * sizeof (wchar_t));
+          appendValue (out, spec, conv.stars, stars, str.c_str ());
+          pos += (len + 1) * sizeof (wchar_t);
+        }
+        else
+        {
+          ok = false;
+        }
+        break;
+      }
+    }
+
+    if (!ok)
+    {
+      // Ran out of data; should not happen unless the format string was changed
+      out += "<?>";
+      return;
+    }
+    p = conv.end;
+  }
+  out.append (p);
+}
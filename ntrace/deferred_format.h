@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdarg.h>
+#include <string>
+
+#include "payload.h"
+
+namespace NTrace
+{
+
+/**
+  \brief Capture printf() arguments now, format them later
+
+  Formatting a log message is relatively expensive; with deferred formatting the
+  caller only walks the format string to find out the types of the arguments and
+  copies their raw values (and the contents of any strings) into a compact binary
+  blob. The output thread then runs the actual printf() formatting.
+
+  Because only a pointer to the format string is kept, the format string must
+  remain valid until the message has been written. Module therefore only defers
+  messages whose format is the string literal of their call site (see
+  CallSite::literal()).
+
+  The %n conversion is not supported; its argument is skipped. For %m the text of
+  errno is captured when the message is logged.
+*/
+class DeferredFormat
+{
+public:
+  static void capture (Payload &out, const char *fmt, va_list args);
+  static void expand (std::string &out, const char *fmt, const Payload &data);
+};
+
+} // namespace
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+namespace NTrace
+{
+
+/**
+  \brief Lets a consumer sleep until a producer has something for it
+
+  An eventcount is a condition variable for lock-free data structures. The
+  consumer announces that it is about to sleep with prepareWait(), checks its
+  queues once more, and then either calls wait() or, if it found work after all,
+  cancelWait(). A producer publishes its data first and then calls notify().
+  If the consumer is not waiting, notify() costs one fence and one atomic load;
+  it only takes the mutex and makes a system call when a wakeup is really needed.
+
+  Because the consumer checks its queues after prepareWait(), a notification
+  that arrives between that check and wait() is never lost.
+*/
+class EventCount
+{
+public:
+  typedef uint32_t Key;
+
+  EventCount ()
+    : m_epoch (0), m_waiters (0)
+  {}
+
+  /// Announce the intention to wait; check the condition after this
+  Key prepareWait ()
+  {
+    m_waiters.fetch_add (1, std::memory_order_seq_cst);
+    return m_epoch.load (std::memory_order_seq_cst);
+  }
+
+  /// The condition turned out to be true; don't wait after all
+  void cancelWait ()
+  {
+    m_waiters.fetch_sub (1, std::memory_order_seq_cst);
+  }
+
+  /**
+   \brief Wait until notify() is called or the timeout expires
+   \param key Value returned by prepareWait()
+   \param timeout Maximum time to wait
+   \return false on timeout
+   */
+  template <typename Rep, typename Period>
+  bool wait (Key key, const std::chrono::duration<Rep, Period> &timeout)
+  {
+    std::unique_lock<std::mutex> lock (m_mutex);
+    bool notified = m_condition.wait_for (lock, timeout, [this, key] { return m_epoch.load (std::memory_order_relaxed) != key; });
+    m_waiters.fetch_sub (1, std::memory_order_seq_cst);
+    return notified;
+  }
+
+  /// Wake up the consumer, if it is waiting; call after publishing the data
+  void notify ()
+  {
+    std::atomic_thread_fence (std::memory_order_seq_cst);
+    if (0 == m_waiters.load (std::memory_order_relaxed))
+    {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock (m_mutex);
+      m_epoch.fetch_add (1, std::memory_order_relaxed);
+    }
+    m_condition.notify_all ();
+  }
+
+private:
+  std::atomic<Key> m_epoch;
+  std::atomic<unsigned int> m_waiters;
+  std::mutex m_mutex;
+  std::condition_variable m_condition;
+};
+
+} // namespace
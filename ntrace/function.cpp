@@ -40,6 +40,7 @@
 #include <stdarg.h>
 #include <stdio.h>
 
+#include "call_site.h"
 #include "function.h"
 #include "interfaces.h"
 
@@ -53,9 +54,10 @@ using namespace NTrace;
 
   The clue is a subtle interaction between the preprocessor and C++ operator overloading.
   If you write your macro as in the examples above, you end up with this in your code:
-  <b>Function TracerObject(s_trace_module, FUNCNAME)(); TraceObject();</b>.
-  This is actually 2 statements. The first declares the object with 2 arguments to the
-  constructor (which is exactly this one). The second statement calls the () operator
+  <b>Function TracerObject(&ntrace_func_site); TracerObject();</b> (preceded by
+  the static CallSite declaration). This is actually 2 statements. The first declares the object
+  with the call site as argument to the constructor (the CallSite version of this one; they work
+  the same). The second statement calls the () operator
   on the object we just created. Actually, the () are replaced by anything you place after
   TR_FUNC, including the ';'. By using an overloaded () operator, it is thus possible
   to supply arguments.
@@ -64,19 +66,27 @@ using namespace NTrace;
 Function::Function (IModule *trace_module, const char *funcname)
 {
   m_trace_module = trace_module;
+  m_site = nullptr;
   m_function_name = funcname;
   m_logged = false; // precaution: in case a typo is made and the () operator is not called do not log a spurious Leave event.
+  m_enabled = (nullptr != trace_module) && trace_module->fastFunctionTracking (); // no work at all when tracking is off
 }
 
-
 /**
   \brief Log without arguments.
  */
 void Function::operator ()()
 {
-  if (m_trace_module)
+  if (m_enabled)
   {
-    m_trace_module->enter (m_function_name);
+    if (m_site)
+    {
+      m_trace_module->enter (m_site);
+    }
+    else
+    {
+      m_trace_module->enter (m_function_name);
+    }
     m_logged = true;
   }
 }
@@ -86,36 +96,47 @@ void Function::operator ()()
  */
 void Function::operator ()(const char *fmt, ...)
 {
-  if (m_trace_module)
+  if (m_enabled)
   {
     va_list args;
-    char buffer[2050];
 
+    // The module decides whether to format now or on the output thread
     va_start (args, fmt);
-#if defined(_WIN32)
-    _vsnprintf (buffer, 2048, fmt, args);
-#else
-    vsnprintf (buffer, 2048, fmt, args);
-#endif
+    if (m_site)
+    {
+      m_trace_module->enter (m_site, fmt, args);
+    }
+    else
+    {
+      m_trace_module->enter (m_function_name, fmt, args);
+    }
     va_end (args);
-
-    m_trace_module->enter (m_function_name, buffer);
   }
   m_logged = true;
 }
 
-Function::~Function ()
+/**
+  \brief Log the function leave; called by the destructor.
+ */
+void Function::finish ()
 {
-  if (m_trace_module)
+  if (m_site)
   {
     if (m_logged)
     {
-      m_trace_module->leave (m_function_name);
+      m_trace_module->leave (m_site);
     }
     else
     {
-      m_trace_module->error (m_function_name + " has malformed TR_FUNC macro!");
+      m_trace_module->error (m_site, std::string (m_site->function) + " has malformed TR_FUNC macro!");
     }
   }
+  else if (m_logged)
+  {
+    m_trace_module->leave (m_function_name);
+  }
+  else
+  {
+    m_trace_module->error (std::string (m_function_name) + " has malformed TR_FUNC macro!");
+  }
 }
-
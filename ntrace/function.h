@@ -2,13 +2,13 @@
 
 #include <string>
 
+#include "call_site.h"
+#include "interfaces.h"
 #include "ntrace_exports.h"
 
 namespace NTrace
 {
 
-class IModule;
-
 /**
   \brief Helper class to automatically log enter and leave events
 
@@ -20,7 +20,33 @@ class Function
 {
 public:
   NTRACE_EXPORT Function (IModule *trace_module, const char *funcname);
-  NTRACE_EXPORT ~Function ();
+
+  /**
+    \brief Constructor used by the TR_FUNC macro
+    \param site Static description of the TR_FUNC statement
+
+    The module and function name are taken from \p site. This is inline, so that a TR_FUNC in a module without function tracking costs no more
+    than a check of the module's gate word.
+   */
+  Function (const CallSite *site)
+    : m_trace_module (*site->module), m_site (site), m_function_name (site->function), m_logged (false)
+  {
+    m_enabled = (nullptr != m_trace_module) && m_trace_module->fastFunctionTracking ();
+  }
+
+  ~Function ()
+  {
+    if (m_enabled)
+    {
+      finish ();
+    }
+  }
+
+  /// Returns false if nothing will be logged; TR_FUNC skips the () operator in that case
+  bool isEnabled () const
+  {
+    return m_enabled;
+  }
 
   NTRACE_EXPORT void NTRACE_CALL operator ()();
 #if defined(__GCC__) && (__GCC__ >= 4)
@@ -30,9 +56,13 @@ public:
 #endif
 
 private:
+  NTRACE_EXPORT void NTRACE_CALL finish ();
+
   IModule *m_trace_module; ///< Pointer to the module object
-  std::string m_function_name;  ///< Name that was determined upon function invocation
+  const CallSite *m_site; ///< The TR_FUNC statement; null when constructed with a function name
+  const char *m_function_name;  ///< Name that was determined upon function invocation; a static string
   bool m_logged;  ///< Whether an enter() was logged
+  bool m_enabled; ///< Whether we log anything at all
 };
 
 } // namespace
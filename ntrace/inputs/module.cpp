@@ -1,8 +1,12 @@
 #define _CRT_SECURE_NO_WARNINGS
 
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 
+#include <utility>
+
+#include "ntrace/deferred_format.h"
 #include "ntrace/manager.h"
 #include "module.h"
 
@@ -12,6 +16,72 @@
   
 using namespace NTrace;
 
+static const int s_buffersize = 2048;
+
+/**
+  \brief Local buffer for all formatting
+
+  One per thread, so any number of threads can log through the same module
+  at the same time without locking.
+ */
+static thread_local char s_buffer[s_buffersize];
+
+/**
+  \brief Format into the buffer of the calling thread
+  \return Pointer to the formatted text; valid until the next call from the same thread
+ */
+static const char *formatBuffer (const char *fmt, va_list args)
+{
+#if defined(_WIN32)
+  _vsnprintf (s_buffer, s_buffersize, fmt, args);
+  s_buffer[s_buffersize - 1] = '\0'; // _vsnprintf does not terminate on overflow
+#else
+  vsnprintf (s_buffer, s_buffersize, fmt, args);
+#endif
+  return s_buffer;
+}
+
+/**
+  \brief Look up the ID of a function name
+
+  Keeps a small cache per thread, so only the first call for a name takes the lock
+  of the function name table.
+ */
+static uint32_t functionId (const char *function)
+{
+  struct CacheEntry
+  {
+    const char *name;
+    uint32_t id;
+  };
+  static thread_local CacheEntry cache[64];
+
+  CacheEntry &entry = cache[(reinterpret_cast<uintptr_t> (function) >> 3) % 64];
+  if (entry.name != function)
+  {
+    entry.id = IManager::registerFunction (function);
+    entry.name = function;
+  }
+  return entry.id;
+}
+
+/**
+  \brief Look up the ID of the function of a TR_FUNC() statement
+
+  The ID is stored in the call site itself. Two threads may race to fill it in,
+  but since they both get the same ID from the table that does no harm.
+ */
+static uint32_t functionId (const CallSite *site)
+{
+  uint32_t id = site->functionId.load (std::memory_order_relaxed);
+  if (0 == id)
+  {
+    id = IManager::registerFunction (site->function);
+    site->functionId.store (id, std::memory_order_relaxed);
+  }
+  return id;
+}
+
 /**
   \brief Constructor; there is no default constructor.
 
@@ -20,31 +90,31 @@ using namespace NTrace;
   \param level Initial level
  */
 Module::Module (IManager *mgr, const std::string &name, int level, bool track_enter_leave)
-  : IInput(mgr), InputBase(mgr, name),
-  m_level (level), m_functionTracking (track_enter_leave)
+  : IInput(mgr), InputBase(mgr, name)
 {
-  // nothing to do here
+  // The level and tracking flag live in the gate word of IModule
+  setGateLevel (level);
+  setGateFunctionTracking (track_enter_leave);
 }
 
 int Module::getLevel () const
 {
-  return m_level;
+  return fastLevel ();
 }
 
 void Module::setLevel (int level)
 {
-  if (level >= 0)
-    m_level = level;
+  setGateLevel (level);
 }
 
 bool Module::getFunctionTracking () const
 {
-  return m_functionTracking;
+  return fastFunctionTracking ();
 }
 
 void Module::setFunctionTracking (bool enable)
 {
-  m_functionTracking = enable;
+  setGateFunctionTracking (enable);
 }
 
 #if 0
@@ -125,6 +195,28 @@ void Module::leave (const std::string &file_name, int line_number)
 
 #endif
 
+/**
+ \brief Fill in message text from a format string and arguments
+ \param message The message to fill
+ \param fmt Formatting string
+ \param args Arguments for \p fmt
+
+ Unfortunately we cannot propagate the ellipses (...), so we must build the string here.
+ With deferred formatting enabled only the arguments are captured and the output thread
+ does the actual formatting; but only when \p fmt is the string literal of the call
+ site, since any other format string may be gone by the time the message is written.
+ */
+void Module::formatMessage (Message &message, const char *fmt, va_list args)
+{
+  if (m_manager->getDeferredFormatting () && message.site && message.site->format == fmt)
+  {
+    message.format = fmt;
+    DeferredFormat::capture (message.message, fmt, args);
+    return;
+  }
+  message.message = formatBuffer (fmt, args);
+}
+
 /**
  \brief Log message with printf() style formatting
  \param level Desired log level
@@ -135,26 +227,18 @@ void Module::leave (const std::string &file_name, int line_number)
  */
 void Module::log (int level, const char *fmt, ...)
 {
-  Message message;
+  Message message (this);
   va_list args;
 
-  if (level > m_level)
+  if (level > fastLevel ())
     return;
 
-  /* Unfortunately we cannot propagate the ellipses (...), so we must build
-     the string here */
-  va_start (args, fmt);
-#if defined(_WIN32)
-  _vsnprintf (m_buffer, 2048, fmt, args);
-#else
-  vsnprintf (m_buffer, 2048, fmt, args);
-#endif
-  va_end (args);
-
   message.level = level;
   message.type = Message::Normal;
-  message.message = m_buffer;
-  m_manager->pushMessage (message);
+  va_start (args, fmt);
+  formatMessage (message, fmt, args);
+  va_end (args);
+  m_manager->pushMessage (std::move (message));
 }
 
 /**
@@ -167,15 +251,15 @@ void Module::log (int level, const char *fmt, ...)
  */
 void Module::log (int level, const std::string &msg)
 {
-  Message message;
+  Message message (this);
 
-  if (level > m_level)
+  if (level > fastLevel ())
     return;
 
   message.level = level;
   message.type = Message::Normal;
   message.message = msg;
-  m_manager->pushMessage (message);
+  m_manager->pushMessage (std::move (message));
 }
 
 /**
@@ -189,20 +273,14 @@ void Module::log (int level, const std::string &msg)
  */
 void Module::error (const char *fmt, ...)
 {
-  Message message;
+  Message message (this);
   va_list args;
 
+  message.type = Message::Error;
   va_start (args, fmt);
-#if defined(_WIN32)
-  _vsnprintf (m_buffer, 2048, fmt, args);
-#else
-  vsnprintf (m_buffer, 2048, fmt, args);
-#endif
+  formatMessage (message, fmt, args);
   va_end (args);
-
-  message.type = Message::Error;
-  message.message = m_buffer;
-  m_manager->pushMessage (message);
+  m_manager->pushMessage (std::move (message));
 }
 
 /**
@@ -210,11 +288,11 @@ void Module::error (const char *fmt, ...)
  */
 void Module::error (const std::string &msg)
 {
-  Message message;
+  Message message (this);
 
   message.type = Message::Error;
   message.message = msg;
-  m_manager->pushMessage (message);
+  m_manager->pushMessage (std::move (message));
 }
 
 /**
@@ -227,63 +305,218 @@ void Module::error (const std::string &msg)
  */
 void Module::out (const char *fmt, ...)
 {
-  Message message;
+  Message message (this);
   va_list args;
 
+  message.type = Message::Out;
   va_start (args, fmt);
-#if defined(_WIN32)
-  _vsnprintf (m_buffer, 2048, fmt, args);
-#else
-  vsnprintf (m_buffer, 2048, fmt, args);
-#endif
+  formatMessage (message, fmt, args);
   va_end (args);
+  m_manager->pushMessage (std::move (message));
+}
+
+void Module::out (const std::string &msg)
+{
+  Message message (this);
 
   message.type = Message::Out;
-  message.message = m_buffer;
-  m_manager->pushMessage (message);
+  message.message = msg;
+  m_manager->pushMessage (std::move (message));
 }
 
-void Module::out (const std::string &msg)
+/**
+ \brief Log function enter
+ \param function The function name; only the pointer is stored
+
+ The message carries the ID of the name in the function name table; see IManager::registerFunction().
+ */
+void Module::enter (const char *function)
+{
+  if (fastFunctionTracking ())
+  {
+    Message message (this);
+
+    message.type = Message::Entry;
+    message.functionId = functionId (function);
+    m_manager->pushMessage (std::move (message));
+  }
+}
+
+void Module::enter (const char *function, const char *args, size_t length)
+{
+  if (fastFunctionTracking ())
+  {
+    Message message (this);
+
+    message.type = Message::Entry;
+    message.functionId = functionId (function);
+    message.message.assign (args, length);
+    m_manager->pushMessage (std::move (message));
+  }
+}
+
+void Module::enter (const char *function, const char *fmt, va_list args)
+{
+  if (fastFunctionTracking ())
+  {
+    Message message (this);
+
+    message.type = Message::Entry;
+    message.functionId = functionId (function);
+    formatMessage (message, fmt, args);
+    m_manager->pushMessage (std::move (message));
+  }
+}
+
+void Module::leave (const char *function)
+{
+  if (fastFunctionTracking ())
+  {
+    Message message (this);
+
+    message.type = Message::Exit;
+    message.functionId = functionId (function);
+    m_manager->pushMessage (std::move (message));
+  }
+}
+
+/**
+ \brief Log message from a TR() statement
+ \param site Static description of the statement
+ \param level Desired log level
+ \param fmt Formatting string
+
+ Same as log(int, const char *, ...), but the message refers to the call site.
+ */
+void Module::log (const CallSite *site, int level, const char *fmt, ...)
+{
+  Message message (this);
+  va_list args;
+
+  if (level > fastLevel ())
+    return;
+
+  message.site = site;
+  message.level = level;
+  message.type = Message::Normal;
+  va_start (args, fmt);
+  formatMessage (message, fmt, args);
+  va_end (args);
+  m_manager->pushMessage (std::move (message));
+}
+
+/**
+ \overload
+ */
+void Module::log (const CallSite *site, int level, const std::string &msg)
+{
+  Message message (this);
+
+  if (level > fastLevel ())
+    return;
+
+  message.site = site;
+  message.level = level;
+  message.type = Message::Normal;
+  message.message = msg;
+  m_manager->pushMessage (std::move (message));
+}
+
+/**
+ \brief Log error from a TR_ERR() statement
+ */
+void Module::error (const CallSite *site, const char *fmt, ...)
 {
-  Message message;
+  Message message (this);
+  va_list args;
+
+  message.site = site;
+  message.type = Message::Error;
+  va_start (args, fmt);
+  formatMessage (message, fmt, args);
+  va_end (args);
+  m_manager->pushMessage (std::move (message));
+}
 
+/**
+ \overload
+ */
+void Module::error (const CallSite *site, const std::string &msg)
+{
+  Message message (this);
+
+  message.site = site;
+  message.type = Message::Error;
+  message.message = msg;
+  m_manager->pushMessage (std::move (message));
+}
+
+/**
+ \brief Output from a TR_OUT() statement
+ */
+void Module::out (const CallSite *site, const char *fmt, ...)
+{
+  Message message (this);
+  va_list args;
+
+  message.site = site;
+  message.type = Message::Out;
+  va_start (args, fmt);
+  formatMessage (message, fmt, args);
+  va_end (args);
+  m_manager->pushMessage (std::move (message));
+}
+
+void Module::out (const CallSite *site, const std::string &msg)
+{
+  Message message (this);
+
+  message.site = site;
   message.type = Message::Out;
   message.message = msg;
-  m_manager->pushMessage (message);
+  m_manager->pushMessage (std::move (message));
 }
 
-void Module::enter (const std::string &function)
+/**
+ \brief Log function enter from a TR_FUNC statement
+ \param site Static description of the statement
+ */
+void Module::enter (const CallSite *site)
 {
-  if (m_functionTracking)
+  if (fastFunctionTracking ())
   {
-    Message message;
+    Message message (this);
 
+    message.site = site;
     message.type = Message::Entry;
-    message.message = function;
-    m_manager->pushMessage (message);
+    message.functionId = functionId (site);
+    m_manager->pushMessage (std::move (message));
   }
 }
 
-void Module::enter (const std::string &function, const std::string &args)
+void Module::enter (const CallSite *site, const char *fmt, va_list args)
 {
-  if (m_functionTracking)
+  if (fastFunctionTracking ())
   {
-    Message message;
+    Message message (this);
 
+    message.site = site;
     message.type = Message::Entry;
-    message.message = function + " (" + args + ")";
-    m_manager->pushMessage (message);
+    message.functionId = functionId (site);
+    formatMessage (message, fmt, args);
+    m_manager->pushMessage (std::move (message));
   }
 }
 
-void Module::leave (const std::string &function)
+void Module::leave (const CallSite *site)
 {
-  if (m_functionTracking)
+  if (fastFunctionTracking ())
   {
-    Message message;
+    Message message (this);
 
+    message.site = site;
     message.type = Message::Exit;
-    message.message = function;
-    m_manager->pushMessage (message);
+    message.functionId = functionId (site);
+    m_manager->pushMessage (std::move (message));
   }
 }
@@ -40,15 +40,24 @@ public:
   virtual void NTRACE_CALL log (int level, const std::string &msg);
   virtual void NTRACE_CALL error (const std::string &msg);
   virtual void NTRACE_CALL out (const std::string &msg);
-  virtual void NTRACE_CALL enter (const std::string &function);
-  virtual void NTRACE_CALL enter (const std::string &function, const std::string &args);
-  virtual void NTRACE_CALL leave (const std::string &function);
+  virtual void NTRACE_CALL enter (const char *function);
+  virtual void NTRACE_CALL enter (const char *function, const char *args, size_t length);
+  virtual void NTRACE_CALL enter (const char *function, const char *fmt, va_list args);
+  virtual void NTRACE_CALL leave (const char *function);
+
+  virtual void NTRACE_CALL log (const CallSite *site, int level, const char *fmt, ...);
+  virtual void NTRACE_CALL log (const CallSite *site, int level, const std::string &msg);
+  virtual void NTRACE_CALL error (const CallSite *site, const char *fmt, ...);
+  virtual void NTRACE_CALL error (const CallSite *site, const std::string &msg);
+  virtual void NTRACE_CALL out (const CallSite *site, const char *fmt, ...);
+  virtual void NTRACE_CALL out (const CallSite *site, const std::string &msg);
+  virtual void NTRACE_CALL enter (const CallSite *site);
+  virtual void NTRACE_CALL enter (const CallSite *site, const char *fmt, va_list args);
+  virtual void NTRACE_CALL leave (const CallSite *site);
 
 private:
-  int m_level; ///< Our current log level
-  bool m_functionTracking; ///< if true, function tracking is enabled
-  static const int s_buffersize = 2048;
-	char m_buffer[s_buffersize]; ///< Local buffer for all formatting
+  void formatMessage (Message &message, const char *fmt, va_list args);
+
 };
 
 } // namespace
@@ -1,10 +1,14 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <list>
 #include <memory>
+#include <stdarg.h>
 
 /* Input/output interfaces for NTrace */
 
+#include "call_site.h"
 #include "message.h"
 #include "ntrace_exports.h"
 
@@ -172,32 +176,161 @@ public:
   */
   virtual void NTRACE_CALL setFunctionTracking (bool enable) = 0;
 
+  /**
+  \brief Current maximum log level, without a virtual call
+
+  The TR() macro compares against this before the arguments are evaluated, so
+  a disabled statement costs one load and a branch. It is safe to call while
+  another thread calls setLevel().
+  */
+  int fastLevel () const
+  {
+    return (int)(m_gate.load (std::memory_order_relaxed) & s_levelMask);
+  }
+
+  /**
+  \brief Report whether or not function enter and leaves are tracked, without a virtual call
+  */
+  bool fastFunctionTracking () const
+  {
+    return 0 != (m_gate.load (std::memory_order_relaxed) & s_trackingBit);
+  }
+
 
   /**
   \brief Track function enter without arguments
   \param function The function name
 
   Logs a function enter without any arguments, just the function name or filename & linenumber.
+
+  \note The name is not copied, only the pointer is passed on to the output thread;
+  it must remain valid for the life time of the program, as is the case for
+  string literals and __PRETTY_FUNCTION__ / __FUNCTION__.
   */
-  virtual void NTRACE_CALL enter (const std::string &function) = 0;
+  virtual void NTRACE_CALL enter (const char *function) = 0;
 
   /**
   \brief Track function enter with arguments
-  \param function The function name
-  \param args Formatted argsuments 
+  \param function The function name; see the note at enter(const char *)
+  \param args Formatted arguments; need not be zero terminated
+  \param length Number of characters in \p args
+
+  Logs a function enter with arguments; the arguments must be already formatted and are passed to the manager as a whole
+  (unfortunately, you cannot pass variadic arguments). Unlike the function name, the arguments are copied.
+  */
+  virtual void NTRACE_CALL enter (const char *function, const char *args, size_t length) = 0;
+
+  /**
+  \brief Track function enter with printf() style arguments
+  \param function The function name; see the note at enter(const char *)
+  \param fmt Format string for the arguments
+  \param args The arguments, as passed to the variadic caller
 
-  Logs a function enter with arguments; the arguments must be already formated in a string and are passed to the manager as a whole
-  (unfortunately, you cannot pass variadic arguments).
+  Used by NTrace::Function; the arguments are formatted immediately.
   */
-  virtual void NTRACE_CALL enter (const std::string &function, const std::string &args) = 0;
+  virtual void NTRACE_CALL enter (const char *function, const char *fmt, va_list args) = 0;
 
   /**
   \brief Track function leave
-  \param function The function name
+  \param function The function name; see the note at enter(const char *)
 
   Logs the exit from a function call.
   */
-  virtual void NTRACE_CALL leave (const std::string &function) = 0;
+  virtual void NTRACE_CALL leave (const char *function) = 0;
+
+  // The overloads below hide the ones from IInput, so bring those back in scope
+  using IInput::log;
+  using IInput::error;
+  using IInput::out;
+
+  /**
+  \brief Log message with a call site
+  \param site Static description of the TR() statement
+  \param level Debug level of message
+  \param fmt Format string
+
+  Used by the TR() macro; the message carries a pointer to \p site so outputs can
+  find the file, line and function of the statement.
+  */
+  virtual void NTRACE_CALL log (const CallSite *site, int level, const char *fmt, ...) = 0;
+  /// \overload
+  virtual void NTRACE_CALL log (const CallSite *site, int level, const std::string &msg) = 0;
+  /// Log error with a call site; used by TR_ERR()
+  virtual void NTRACE_CALL error (const CallSite *site, const char *fmt, ...) = 0;
+  /// \overload
+  virtual void NTRACE_CALL error (const CallSite *site, const std::string &msg) = 0;
+  /// Output some text with a call site; used by TR_OUT()
+  virtual void NTRACE_CALL out (const CallSite *site, const char *fmt, ...) = 0;
+  /// \overload
+  virtual void NTRACE_CALL out (const CallSite *site, const std::string &msg) = 0;
+
+  /**
+  \brief Track function enter from a TR_FUNC statement
+  \param site Static description of the statement
+
+  Same as enter(const char *) with the function name from \p site.
+  */
+  virtual void NTRACE_CALL enter (const CallSite *site) = 0;
+
+  /**
+  \brief Track function enter from a TR_FUNC statement with arguments
+  \param site Static description of the statement
+  \param fmt Format string for the arguments
+  \param args The arguments
+  */
+  virtual void NTRACE_CALL enter (const CallSite *site, const char *fmt, va_list args) = 0;
+
+  /**
+  \brief Track function leave from a TR_FUNC statement
+  \param site Static description of the statement
+  */
+  virtual void NTRACE_CALL leave (const CallSite *site) = 0;
+
+protected:
+  IModule ()
+    : m_gate (0)
+  {}
+
+  /// Store new level in the gate word; negative levels are ignored
+  void setGateLevel (int level)
+  {
+    if (level < 0)
+    {
+      return;
+    }
+    uint32_t l = (level > (int)s_levelMask) ? s_levelMask : (uint32_t)level;
+    uint32_t old_gate = m_gate.load (std::memory_order_relaxed);
+    while (!m_gate.compare_exchange_weak (old_gate, (old_gate & ~s_levelMask) | l, std::memory_order_relaxed))
+    {
+      // retry
+    }
+  }
+
+  /// Store function tracking flag in the gate word
+  void setGateFunctionTracking (bool enable)
+  {
+    if (enable)
+    {
+      m_gate.fetch_or (s_trackingBit, std::memory_order_relaxed);
+    }
+    else
+    {
+      m_gate.fetch_and (~s_trackingBit, std::memory_order_relaxed);
+    }
+  }
+
+private:
+  static const uint32_t s_levelMask = 0xffff;
+  static const uint32_t s_trackingBit = 0x10000;
+
+  /**
+   \brief Level and function tracking packed in one word
+
+   Read by every TR statement in every thread, but hardly ever written; it gets
+   a cache line of its own so writes to nearby data don't slow down the readers.
+   */
+  alignas (64) std::atomic<uint32_t> m_gate;
+  char m_gatePadding[64 - sizeof (std::atomic<uint32_t>)];
 };
 
 /**
@@ -236,6 +369,35 @@ public:
   a window.
   */
   virtual void NTRACE_CALL saveMessage (const Message &msg) = 0;
+
+  /**
+  \brief Store a batch of messages
+  \param begin First message
+  \param end One past the last message
+
+  The manager hands over all messages that are waiting at once. The default
+  implementation calls saveMessage() for each of them; outputs that can handle a
+  batch more efficiently (for example by writing it to disk with a single system call)
+  should override this.
+  */
+  virtual void NTRACE_CALL saveMessages (const Message *begin, const Message *end)
+  {
+    for (const Message *msg = begin; msg != end; ++msg)
+    {
+      saveMessage (*msg);
+    }
+  }
+
+  /**
+  \brief Called regularly while there are no messages to deliver
+
+  Called by the same thread that calls saveMessages(), at most every few
+  milliseconds. Outputs that keep messages buffered for a while can use this to
+  write them out when no new batch comes in. The default does nothing.
+  */
+  virtual void NTRACE_CALL idle ()
+  {
+  }
 };
 
 
@@ -250,6 +412,14 @@ and sends them to IOutputs. Uses a thread to separate logging from actual writin
 class NTRACE_EXPORT IManager
 {
 public:
+  /**
+  \brief How messages travel from the inputs to the output thread
+  */
+  enum QueueMode
+  {
+    SharedQueue,   ///< One queue for all threads, protected by a mutex (default)
+    ThreadQueues   ///< A lock-free ring buffer per producing thread
+  };
 
   /**
   \brief Create instance of the real manager class
@@ -267,12 +437,56 @@ public:
    */
   static void NTRACE_CALL shutdown ();
 
+  /**
+   \brief Add a function name to the function name table
+   \param name The function name; must be a static string since only the pointer is stored
+   \return The ID of the name; never 0
+
+   Entry and Exit messages carry the ID of the function instead of its name. The
+   table is keyed on the pointer, so registering the same pointer again returns
+   the same ID. The table is global for the whole process and survives shutdown(),
+   so an ID can be cached for as long as the program runs.
+   */
+  static uint32_t NTRACE_CALL registerFunction (const char *name);
+
+  /**
+   \brief Look up a name in the function name table
+   \param id ID returned by registerFunction()
+   \return The function name, or a null pointer for an unknown ID (including 0)
+   */
+  static const char * NTRACE_CALL getFunctionName (uint32_t id);
+
+  /**
+   \brief Return the number of entries in the function name table
+
+   IDs are handed out in sequence, so valid IDs run from 1 up to and including this value.
+   */
+  static uint32_t NTRACE_CALL getFunctionCount ();
+
+  /**
+   \brief Give the calling thread a name
+   \param name The name; an empty string removes the name
+
+   Outputs can look up the name with getThreadName() to show it next to or instead of
+   the thread ID. On Linux the name is passed on to the system as well (only the first
+   15 characters), so it also shows up in top, gdb and perf.
+   */
+  static void NTRACE_CALL setThreadName (const std::string &name);
+
+  /**
+   \brief Return the name of a thread
+   \param tid Thread ID, as found in Message::tid
+   \return The name given with setThreadName(), or an empty string
+   */
+  static std::string NTRACE_CALL getThreadName (int tid);
+
   /**
    \brief Return the starting time of the program
    \return A Timestamp object
 
    Returns the timestamp when IManager was instantiated as a starting point
-   for relative times.
+   for relative times. Like message timestamps it is a monotonic timestamp;
+   subtract it from a message timestamp to get the time in nanoseconds.
    */
   virtual Timestamp NTRACE_CALL getStartTimestamp () const = 0;
 
@@ -336,6 +550,161 @@ public:
   */
   virtual void NTRACE_CALL pushMessage (const Message &msg) = 0;
 
+  /**
+  \brief Move message into the queue
+  \param msg Message to process; it is left empty
+
+  Same as pushMessage(const Message &), but takes over the contents of \p msg
+  instead of copying them. This is what the modules use.
+  */
+  virtual void NTRACE_CALL pushMessage (Message &&msg) = 0;
+
+  /**
+  \brief Select queueing mode
+  \param mode New mode
+
+  In SharedQueue mode every message is appended to a single queue under a mutex. In
+  ThreadQueues mode each thread gets its own bounded ring buffer the first time it logs
+  something; pushing a message is then wait-free and never takes a lock. If a ring is full
+  the message is dropped. Rings are reclaimed after their thread has exited.
+
+  The output thread merges messages from all rings in timestamp order.
+  */
+  virtual void NTRACE_CALL setQueueMode (QueueMode mode) = 0;
+
+  /**
+  \brief Return current queueing mode
+  */
+  virtual QueueMode NTRACE_CALL getQueueMode () const = 0;
+
+  /**
+  \brief What to do with a message when the queue is full
+  */
+  enum OverflowPolicy
+  {
+    DropOldest,   ///< Make room by dropping the oldest messages in the queue (default)
+    DropNewest,   ///< Drop the new message
+    Block,        ///< Wait for room, up to the timeout; then drop the new message
+    BlockErrors   ///< Wait like Block for Error messages; drop other new messages
+  };
+
+  /**
+  \brief Set the size of the message queue
+  \param max_messages Maximum number of messages waiting for the output thread
+  \param max_bytes Maximum total size of the text of those messages; 0 for no limit
+
+  The byte limit keeps a burst of long messages from using a lot more memory than
+  a burst of short ones. A single message is always accepted into an empty queue,
+  even if it is larger than \p max_bytes.
+
+  In ThreadQueues mode \p max_messages applies to each thread separately, and only
+  to threads that start logging after this call; \p max_bytes applies to all
+  threads together. The default is 1000 messages and no byte limit.
+  */
+  virtual void NTRACE_CALL setQueueLimits (size_t max_messages, size_t max_bytes) = 0;
+
+  /**
+  \brief Select what happens when the queue is full
+  \param policy The overflow policy
+  \param timeout_ms How long Block and BlockErrors wait for room, in milliseconds
+
+  The output thread itself never blocks; if it logs to a full queue, the message
+  is dropped. In ThreadQueues mode a thread cannot remove messages from its ring,
+  so DropOldest behaves like DropNewest there.
+
+  Whenever messages are lost, the outputs receive an Error message that says how
+  many were dropped.
+  */
+  virtual void NTRACE_CALL setOverflowPolicy (OverflowPolicy policy, unsigned int timeout_ms = 100) = 0;
+
+  /**
+  \brief Return the current overflow policy
+  */
+  virtual OverflowPolicy NTRACE_CALL getOverflowPolicy () const = 0;
+
+  /**
+  \brief Return the number of messages lost because the queue was full
+  \param policy Count only the messages dropped while this policy was in effect
+  */
+  virtual unsigned long NTRACE_CALL getDroppedMessages (OverflowPolicy policy) const = 0;
+
+  /**
+  \brief How messages are handed to the outputs
+  */
+  enum DeliveryMode
+  {
+    DirectDelivery, ///< The output thread calls all outputs in turn (default)
+    OutputThreads   ///< Each output has its own thread and queue
+  };
+
+  /**
+  \brief Select how messages are handed to the outputs
+  \param mode The delivery mode
+  \param max_messages_per_output Size of the queue of each output in OutputThreads mode
+
+  With DirectDelivery a slow output holds up all the others, and eventually the
+  producers. With OutputThreads each output only holds up itself: the messages are
+  shared between the outputs (not copied), and when the queue of an output is full
+  only that output loses messages; see getOutputDroppedMessages().
+
+  Switching back to DirectDelivery waits until all outputs have caught up.
+  */
+  virtual void NTRACE_CALL setDeliveryMode (DeliveryMode mode, size_t max_messages_per_output = 10000) = 0;
+
+  /**
+  \brief Return the delivery mode
+  */
+  virtual DeliveryMode NTRACE_CALL getDeliveryMode () const = 0;
+
+  /**
+  \brief Return the number of messages an output has lost in OutputThreads mode
+  \param out The output
+  */
+  virtual unsigned long NTRACE_CALL getOutputDroppedMessages (const IOutput *out) const = 0;
+
+  /**
+  \brief Enable or disable deferred formatting
+  \param enable If true, printf() style messages are formatted by the output thread
+
+  With deferred formatting the logging thread only copies the raw arguments (and
+  the contents of string arguments); the format string itself is not copied. So
+  this only applies to TR(), TR_ERR() and TR_OUT() statements whose format is a
+  string literal; all other messages, including those of TR_FUNC() and of calls
+  to IModule itself, are formatted right away.
+  */
+  virtual void NTRACE_CALL setDeferredFormatting (bool enable) = 0;
+
+  /**
+  \brief Report whether or not formatting is deferred to the output thread
+  */
+  virtual bool NTRACE_CALL getDeferredFormatting () const = 0;
+
+  /**
+  \brief Where message timestamps come from
+  */
+  enum ClockSource
+  {
+    SystemClock, ///< Ask the system for the time of each message (default)
+    TscClock     ///< Read the CPU time stamp counter; converted on the output thread
+  };
+
+  /**
+  \brief Select the source of message timestamps
+  \param source The clock to use
+  \return false if the source is not available; the current source stays in use
+
+  Reading the time stamp counter is a lot cheaper than asking the system for the
+  time. The output thread converts the counter values to real time, using a
+  calibration that it refreshes every second. The TSC is only available on x86
+  CPUs that report an invariant TSC.
+  */
+  virtual bool NTRACE_CALL setClockSource (ClockSource source) = 0;
+
+  /**
+  \brief Return the source of message timestamps
+  */
+  virtual ClockSource NTRACE_CALL getClockSource () const = 0;
+
   /**
   \brief Create default debug output stream
 
@@ -0,0 +1,120 @@
+#include <cmath>
+
+#include "latency_histogram.h"
+
+using namespace NTrace;
+
+LatencyHistogram::LatencyHistogram ()
+  : m_count (0), m_min (0), m_max (0), m_total (0)
+{
+}
+
+/**
+  \brief Count a value
+  \param value The value, usually a duration in nanoseconds
+ */
+void LatencyHistogram::record (uint64_t value)
+{
+  size_t index = bucketIndex (value);
+  if (index >= m_buckets.size ())
+  {
+    m_buckets.resize (index + 1, 0);
+  }
+  m_buckets[index]++;
+
+  if (0 == m_count || value < m_min)
+  {
+    m_min = value;
+  }
+  if (value > m_max)
+  {
+    m_max = value;
+  }
+  m_count++;
+  m_total += value;
+}
+
+/**
+  \brief Forget all values
+ */
+void LatencyHistogram::reset ()
+{
+  m_buckets.clear ();
+  m_count = 0;
+  m_min = 0;
+  m_max = 0;
+  m_total = 0;
+}
+
+/**
+  \brief Return the value below which the given percentage of values lie
+  \param percentile Percentage, from 0 to 100; e.g. 50 for the median, 99.9 for the 999th permille
+
+  Returns the upper limit of the bucket that contains the value, but never more
+  than the largest value recorded. Returns 0 if the histogram is empty.
+ */
+uint64_t LatencyHistogram::getPercentile (double percentile) const
+{
+  if (0 == m_count)
+  {
+    return 0;
+  }
+  uint64_t rank = static_cast<uint64_t> (std::ceil (percentile / 100.0 * m_count));
+  if (rank < 1)
+  {
+    rank = 1;
+  }
+
+  uint64_t seen = 0;
+  for (size_t i = 0; i < m_buckets.size (); i++)
+  {
+    seen += m_buckets[i];
+    if (seen >= rank)
+    {
+      uint64_t limit = bucketLimit (i);
+      return limit < m_max ? limit : m_max;
+    }
+  }
+  return m_max;
+}
+
+/**
+  \brief Return the bucket for a value
+
+  Values below 2 * s_subBuckets have a bucket each. Above that, a value with its
+  highest bit at position b is shifted right by b - s_subBucketBits, which leaves
+  s_subBucketBits + 1 significant bits; each shift gets its own row of s_subBuckets
+  buckets.
+ */
+size_t LatencyHistogram::bucketIndex (uint64_t value)
+{
+  if (value < s_subBuckets)
+  {
+    return value;
+  }
+#if defined(__GNUC__)
+  unsigned int msb = 63 - __builtin_clzll (value);
+#else
+  unsigned int msb = 0;
+  for (uint64_t v = value; v > 1; v >>= 1)
+  {
+    msb++;
+  }
+#endif
+  unsigned int shift = msb - s_subBucketBits;
+  return shift * s_subBuckets + (value >> shift);
+}
+
+/**
+  \brief Return the largest value that falls in a bucket
+ */
+uint64_t LatencyHistogram::bucketLimit (size_t index)
+{
+  if (index < 2 * s_subBuckets)
+  {
+    return index;
+  }
+  unsigned int shift = index / s_subBuckets - 1;
+  uint64_t sub = index - shift * s_subBuckets;
+  return ((sub + 1) << shift) - 1;
+}
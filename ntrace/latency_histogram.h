@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace NTrace
+{
+
+/**
+  \brief Histogram of durations with a fixed relative precision
+
+  Values are counted in log-linear buckets, as in HdrHistogram: every power of 2
+  is split into s_subBuckets buckets, so a reported value is never more than about
+  1.5% off, whether it is 100 nanoseconds or 10 seconds. Recording a value is an
+  index calculation and an increment; the bucket array only grows as far as the
+  largest value seen.
+
+  Not thread-safe.
+*/
+class LatencyHistogram
+{
+public:
+  LatencyHistogram ();
+
+  void record (uint64_t value);
+  void reset ();
+
+  uint64_t getPercentile (double percentile) const;
+
+  /// Number of recorded values
+  uint64_t getCount () const
+  {
+    return m_count;
+  }
+
+  /// Smallest recorded value; 0 if the histogram is empty
+  uint64_t getMin () const
+  {
+    return m_count > 0 ? m_min : 0;
+  }
+
+  /// Largest recorded value
+  uint64_t getMax () const
+  {
+    return m_max;
+  }
+
+  /// Sum of all recorded values
+  uint64_t getTotal () const
+  {
+    return m_total;
+  }
+
+  /// Number of buckets per power of 2
+  static const unsigned int s_subBucketBits = 6;
+  static const uint64_t s_subBuckets = 1 << s_subBucketBits;
+
+private:
+  static size_t bucketIndex (uint64_t value);
+  static uint64_t bucketLimit (size_t index);
+
+  std::vector<uint64_t> m_buckets;
+  uint64_t m_count;
+  uint64_t m_min;
+  uint64_t m_max;
+  uint64_t m_total;
+};
+
+} // namespace
@@ -0,0 +1,375 @@
+#if defined(_WIN32)
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <time.h>
+
+#include "call_site.h"
+#include "interfaces.h"
+#include "layout.h"
+#include "output_base.h"
+
+using namespace NTrace;
+
+/**
+  \brief Append a number in decimal
+  \param out String to append to
+  \param value The number
+  \param width Minimum number of characters; padded on the left with \p fill
+  \param fill Padding character
+ */
+static void appendNumber (std::string &out, uint64_t value, int width, char fill)
+{
+  char buf[24];
+  char *end = buf + sizeof (buf);
+  char *p = end;
+  do
+  {
+    *--p = (char)('0' + value % 10);
+    value /= 10;
+  } while (value > 0);
+  while (end - p < width)
+  {
+    *--p = fill;
+  }
+  out.append (p, end - p);
+}
+
+static void appendSigned (std::string &out, int64_t value, int width, char fill)
+{
+  if (value < 0)
+  {
+    out += '-';
+    appendNumber (out, (uint64_t)-value, width - 1, fill);
+  }
+  else
+  {
+    appendNumber (out, (uint64_t)value, width, fill);
+  }
+}
+
+/**
+  \brief Append the fraction of a second
+  \param out String to append to
+  \param nanos Nanoseconds part
+  \param precision Number of digits; 0 appends nothing
+ */
+static void appendFraction (std::string &out, uint32_t nanos, int precision)
+{
+  if (precision <= 0)
+  {
+    return;
+  }
+  char buf[8];
+  uint32_t value = 3 == precision ? nanos / 1000000 : nanos / 1000;
+  buf[0] = '.';
+  for (int i = precision; i > 0; i--)
+  {
+    buf[i] = (char)('0' + value % 10);
+    value /= 10;
+  }
+  out.append (buf, precision + 1);
+}
+
+/**
+  \brief Constructor
+  \param pattern The layout; see the class description
+  \param start_time Timestamp that %rel counts from
+ */
+Layout::Layout (const std::string &pattern, const Timestamp &start_time)
+  : m_startTime (start_time), m_indent (0), m_realtimeOffset (0), m_offsetSecond (-1)
+{
+  compile (pattern);
+}
+
+/**
+  \brief Replace the pattern
+  \param pattern The layout; see the class description
+ */
+void Layout::compile (const std::string &pattern)
+{
+  static const struct
+  {
+    const char *name;
+    FieldType type;
+    bool timed; ///< Takes a .ms or .us suffix
+  } names[] =
+  {
+    { "pid", Pid, false },
+    { "tid", Tid, false },
+    { "utc", Utc, true },
+    { "local", Local, true },
+    { "rel", Relative, true },
+    { "level", Level, false },
+    { "module", Module, false },
+    { "file", File, false },
+    { "line", Line, false },
+    { "indent", Indent, false },
+    { "msg", Text, false },
+  };
+
+  m_fields.clear ();
+  m_utcCache.second = -1;
+  m_localCache.second = -1;
+
+  std::string literal;
+  size_t pos = 0;
+  while (pos < pattern.size ())
+  {
+    if (pattern[pos] != '%')
+    {
+      literal += pattern[pos++];
+      continue;
+    }
+    if (pos + 1 < pattern.size () && '%' == pattern[pos + 1])
+    {
+      literal += '%';
+      pos += 2;
+      continue;
+    }
+
+    // The name of the field is the run of lowercase letters after the '%'
+    size_t name_end = pos + 1;
+    while (name_end < pattern.size () && pattern[name_end] >= 'a' && pattern[name_end] <= 'z')
+    {
+      name_end++;
+    }
+    std::string name = pattern.substr (pos + 1, name_end - pos - 1);
+    bool found = false;
+    for (size_t i = 0; i < sizeof (names) / sizeof (names[0]); i++)
+    {
+      if (name != names[i].name)
+      {
+        continue;
+      }
+      Field field;
+      field.type = names[i].type;
+      field.precision = 0;
+      if (names[i].timed && 0 == pattern.compare (name_end, 3, ".ms"))
+      {
+        field.precision = 3;
+        name_end += 3;
+      }
+      else if (names[i].timed && 0 == pattern.compare (name_end, 3, ".us"))
+      {
+        field.precision = 6;
+        name_end += 3;
+      }
+      if (!literal.empty ())
+      {
+        Field text = { Literal, 0, literal };
+        m_fields.push_back (text);
+        literal.clear ();
+      }
+      m_fields.push_back (field);
+      found = true;
+      break;
+    }
+    if (found)
+    {
+      pos = name_end;
+    }
+    else
+    {
+      literal += pattern[pos++];
+    }
+  }
+  if (!literal.empty ())
+  {
+    Field text = { Literal, 0, literal };
+    m_fields.push_back (text);
+  }
+}
+
+/**
+  \brief Format a message
+  \param msg The message
+  \param out String to append the text to; no newline is added
+ */
+void Layout::format (const Message &msg, std::string &out)
+{
+  for (std::vector<Field>::const_iterator it = m_fields.begin (); it != m_fields.end (); ++it)
+  {
+    switch (it->type)
+    {
+      case Literal:
+        out += it->text;
+        break;
+
+      case Pid:
+        appendSigned (out, msg.pid, 5, ' ');
+        break;
+
+      case Tid:
+        appendSigned (out, msg.tid, 0, ' ');
+        break;
+
+      case Utc:
+        appendDate (m_utcCache, true, realtimeNanos (msg.timestamp), it->precision, out);
+        break;
+
+      case Local:
+        appendDate (m_localCache, false, realtimeNanos (msg.timestamp), it->precision, out);
+        break;
+
+      case Relative:
+      {
+        int64_t nanos = msg.timestamp - m_startTime;
+        if (nanos < 0)
+        {
+          out += '-';
+          nanos = -nanos;
+          appendNumber (out, (uint64_t)(nanos / 1000000000), 5, ' ');
+        }
+        else
+        {
+          appendNumber (out, (uint64_t)(nanos / 1000000000), 6, ' ');
+        }
+        appendFraction (out, (uint32_t)(nanos % 1000000000), it->precision);
+        break;
+      }
+
+      case Level:
+        appendSigned (out, msg.level, 0, ' ');
+        break;
+
+      case Module:
+        if (msg.module)
+        {
+          out += moduleName (msg.module);
+        }
+        break;
+
+      case File:
+        if (msg.site)
+        {
+          const char *name = msg.site->file;
+          for (const char *p = name; *p; p++)
+          {
+            if ('/' == *p || '\\' == *p)
+            {
+              name = p + 1;
+            }
+          }
+          out += name;
+        }
+        else
+        {
+          out += '?';
+        }
+        break;
+
+      case Line:
+        if (msg.site)
+        {
+          appendSigned (out, msg.site->line, 0, ' ');
+        }
+        else
+        {
+          out += '?';
+        }
+        break;
+
+      case Indent:
+        switch (msg.type)
+        {
+          case Message::Normal:
+            out.append (2 * m_indent, ' ');
+            break;
+          case Message::Entry:
+            out.append (2 * m_indent, ' ');
+            out += ">> ";
+            m_indent++;
+            break;
+          case Message::Exit:
+            if (m_indent > 0)
+            {
+              m_indent--;
+            }
+            out.append (2 * m_indent, ' ');
+            out += "<< ";
+            break;
+          default:
+            break;
+        }
+        break;
+
+      case Text:
+        OutputBase::appendText (msg, out);
+        break;
+    }
+  }
+}
+
+/**
+  \brief Return the wall clock time of a timestamp in nanoseconds since the epoch
+
+  Same as Timestamp::toRealtime(), but reads the clocks at most once a second.
+ */
+int64_t Layout::realtimeNanos (const Timestamp &timestamp)
+{
+  if (Timestamp::Monotonic != timestamp.getDomain ())
+  {
+    return timestamp.getNanos ();
+  }
+  int64_t second = timestamp.getNanos () / 1000000000;
+  if (second != m_offsetSecond)
+  {
+    m_realtimeOffset = timestamp.toRealtime ().getNanos () - timestamp.getNanos ();
+    m_offsetSecond = second;
+  }
+  return timestamp.getNanos () + m_realtimeOffset;
+}
+
+/**
+  \brief Append date and time, converting it only if the second has changed
+ */
+void Layout::appendDate (DateCache &cache, bool utc, int64_t nanos, int precision, std::string &out)
+{
+  int64_t second = nanos / 1000000000;
+  if (second != cache.second)
+  {
+    time_t st = (time_t)second;
+    struct tm when;
+#if defined(_WIN32)
+    bool valid = 0 == (utc ? gmtime_s (&when, &st) : localtime_s (&when, &st));
+#else
+    bool valid = nullptr != (utc ? gmtime_r (&st, &when) : localtime_r (&st, &when));
+#endif
+    cache.text.clear ();
+    if (valid)
+    {
+      appendNumber (cache.text, when.tm_year + 1900, 4, '0');
+      cache.text += '-';
+      appendNumber (cache.text, when.tm_mon + 1, 2, '0');
+      cache.text += '-';
+      appendNumber (cache.text, when.tm_mday, 2, '0');
+      cache.text += ' ';
+      appendNumber (cache.text, when.tm_hour, 2, '0');
+      cache.text += ':';
+      appendNumber (cache.text, when.tm_min, 2, '0');
+      cache.text += ':';
+      appendNumber (cache.text, when.tm_sec, 2, '0');
+    }
+    else
+    {
+      cache.text = "\?\?\?\?-\?\?-\?\? \?\?:\?\?:\?\?";
+    }
+    cache.second = second;
+  }
+  out += cache.text;
+  appendFraction (out, (uint32_t)(nanos % 1000000000), precision);
+}
+
+/**
+  \brief Return the name of a module; looked up once per module
+ */
+const std::string &Layout::moduleName (const IInput *module)
+{
+  std::unordered_map<const IInput *, std::string>::iterator it = m_moduleNames.find (module);
+  if (it == m_moduleNames.end ())
+  {
+    it = m_moduleNames.insert (std::make_pair (module, module->getName ())).first;
+  }
+  return it->second;
+}
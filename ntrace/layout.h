@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "message.h"
+#include "timestamp.h"
+
+namespace NTrace
+{
+
+class IInput;
+
+/**
+  \brief Formats messages as lines of text according to a pattern
+
+  The pattern is plain text with fields that start with a '%':
+
+  - %pid : process ID, right aligned in 5 characters
+  - %tid : thread ID
+  - %utc : date and time in UTC, as YYYY-MM-DD HH:MM:SS
+  - %local : date and time in the local time zone, same form
+  - %rel : seconds since the start time, with 6 characters before the decimal point
+  - %level : log level
+  - %module : name of the module that logged the message
+  - %file : name of the source file of the statement, without the directory
+  - %line : line number of the statement
+  - %indent : indentation by function call depth; also puts ">> " before a function
+    entry and "<< " before an exit
+  - %msg : the text of the message; see OutputBase::getText()
+  - %% : a single '%'
+
+  The time fields take a suffix for the fraction of the second: ".ms" for
+  milliseconds, ".us" for microseconds. A '%' that does not start a known field
+  is copied as is. %file and %line give a '?' for messages without a call site,
+  such as those of the inputs.
+
+  The pattern is parsed once into a list of fields, so formatting a message is a
+  single pass over that list. Numbers are converted by hand, and the date and time
+  are only converted when the second changes; the same goes for the difference
+  between the monotonic clock and the wall clock. The indentation and the caches
+  make a Layout stateful; use one per output.
+
+  Example: "(%pid) [%utc.ms] %msg" gives "(12345) [2024-01-31 12:00:00.123] text".
+*/
+class Layout
+{
+public:
+  Layout (const std::string &pattern, const Timestamp &start_time);
+
+  void compile (const std::string &pattern);
+  void format (const Message &msg, std::string &out);
+
+private:
+  enum FieldType
+  {
+    Literal,
+    Pid,
+    Tid,
+    Utc,
+    Local,
+    Relative,
+    Level,
+    Module,
+    File,
+    Line,
+    Indent,
+    Text
+  };
+  /// A part of the pattern
+  struct Field
+  {
+    FieldType type;
+    int precision;    ///< Digits of the fraction of a second: 0, 3 or 6
+    std::string text; ///< For Literal: the text to copy
+  };
+
+  /// Date and time of the last second that was formatted
+  struct DateCache
+  {
+    int64_t second;
+    std::string text;
+  };
+
+  int64_t realtimeNanos (const Timestamp &timestamp);
+  void appendDate (DateCache &cache, bool utc, int64_t nanos, int precision, std::string &out);
+  const std::string &moduleName (const IInput *module);
+
+  std::vector<Field> m_fields;
+  Timestamp m_startTime;
+  int m_indent;
+  DateCache m_utcCache;
+  DateCache m_localCache;
+  int64_t m_realtimeOffset;   ///< Realtime minus monotonic clock
+  int64_t m_offsetSecond;     ///< Monotonic second in which m_realtimeOffset was determined
+  std::unordered_map<const IInput *, std::string> m_moduleNames;
+};
+
+} // namespace
@@ -7,9 +7,15 @@
 #endif
 #include <sys/types.h>
 
+#include <algorithm>
 #include <chrono>
+#include <unordered_map>
 
+#include "clock.h"
 #include "manager.h"
+#include "output_worker.h"
+#include "spsc_ring.h"
+#include "thread_info.h"
 #include "inputs/module.h"
 #include "outputs/debug_output.h"
 
@@ -40,13 +46,115 @@
 using namespace NTrace;
 
 static Manager *s_traceManager = nullptr;
+static std::atomic<unsigned int> s_managerGeneration (0);
+
+/// Default number of messages in the shared queue and in each per-thread ring
+static const size_t s_defaultMaxMessages = 1000;
+/// How often the TSC calibration is refreshed
+static const std::chrono::seconds s_calibrationInterval (1);
+/// How long the output thread sleeps at most, so the latency stays bounded even if a wakeup is skipped
+static const std::chrono::milliseconds s_pollInterval (10);
+/// Producers also wake the output thread each time this many messages are waiting
+static const size_t s_wakeupBatch = 64;
+/// Number of times the output thread looks for new messages before it goes to sleep
+static const int s_spinCount = 50;
+
+namespace NTrace
+{
+
+/**
+  \brief Message ring for a single producing thread
+
+  Owned both by the Manager and by the thread-local handle of the thread that
+  fills it; whoever lets go last destroys it.
+ */
+struct ThreadQueue
+{
+  ThreadQueue (unsigned int generation, size_t capacity)
+    : ring (capacity), closed (false), generation (generation)
+  {}
+
+  SpscRing<Message> ring;
+  std::atomic<bool> closed;         ///< Set when the producing thread has exited
+  const unsigned int generation;    ///< Manager instance this ring belongs to
+};
+
+} // namespace
+
+namespace
+{
+
+/**
+  \brief Thread-local link to the ring of the current thread
+
+  Marks the ring closed when the thread exits, so the output thread can reclaim it
+  once it has been drained.
+ */
+struct ThreadQueueHandle
+{
+  ~ThreadQueueHandle ()
+  {
+    if (queue)
+    {
+      queue->closed.store (true, std::memory_order_release);
+    }
+  }
+
+  std::shared_ptr<ThreadQueue> queue;
+};
+
+thread_local ThreadQueueHandle s_threadQueue;
+
+/// Set for the output thread, which must never wait for room in the queue
+thread_local bool s_isOutputThread = false;
+
+/**
+  \brief The function name table
+
+  Not tied to a Manager instance, since call sites cache their ID for the lifetime
+  of the program. Allocated once and never freed, so it is still usable while
+  static objects are destroyed.
+ */
+struct FunctionTable
+{
+  FunctionTable ()
+    : names (1, nullptr) // ID 0 is reserved
+  {}
+
+  std::mutex mutex;
+  std::unordered_map<const char *, uint32_t> ids;
+  std::vector<const char *> names;
+};
+
+FunctionTable &functionTable ()
+{
+  static FunctionTable *table = new FunctionTable;
+  return *table;
+}
+
+}
 
 /***************************************************************************/
 
 
 Manager::Manager ()
+  : m_messages (s_defaultMaxMessages), m_spareMessages (s_defaultMaxMessages), m_sharedCount (0), m_blockedProducers (0), m_queuedBytes (0),
+    m_maxMessages (s_defaultMaxMessages), m_maxBytes (0), m_threadQueueBytes (0),
+    m_overflowPolicy (DropOldest), m_blockTimeout (100), m_droppedReported (0),
+    m_queueMode (SharedQueue), m_deferredFormatting (false),
+    m_startTime (Timestamp::now (Timestamp::Monotonic))
 {
+  for (int i = DropOldest; i <= BlockErrors; i++)
+  {
+    m_dropped[i] = 0;
+  }
   m_endLoop = false;
+  m_generation = ++s_managerGeneration;
+
+  std::shared_ptr<OutputSet> outputs = std::make_shared<OutputSet> ();
+  outputs->deliveryMode = DirectDelivery;
+  outputs->outputQueueSize = 0;
+  m_outputSet = outputs;
 }
 
 Manager::~Manager ()
@@ -56,7 +164,9 @@ Manager::~Manager ()
   // Clean up modules (should clear IModules through shared pointers)
   m_modules.clear ();
   // output modules are also shared_ptr so automatically cleaned up
-  m_outputs.clear ();
+  m_outputSet.reset ();
+  // Rings that are still in use by a thread are freed when that thread exits
+  m_threadQueues.clear ();
 }
 
 
@@ -83,6 +193,52 @@ void IManager::shutdown ()
   s_traceManager = 0;
 }
 
+uint32_t IManager::registerFunction (const char *name)
+{
+  FunctionTable &table = functionTable ();
+  std::lock_guard<std::mutex> lock (table.mutex);
+
+  std::unordered_map<const char *, uint32_t>::iterator it = table.ids.find (name);
+  if (it != table.ids.end ())
+  {
+    return it->second;
+  }
+  uint32_t id = (uint32_t)table.names.size ();
+  table.names.push_back (name);
+  table.ids[name] = id;
+  return id;
+}
+
+const char *IManager::getFunctionName (uint32_t id)
+{
+  FunctionTable &table = functionTable ();
+  std::lock_guard<std::mutex> lock (table.mutex);
+
+  if (id >= table.names.size ())
+  {
+    return nullptr;
+  }
+  return table.names[id];
+}
+
+uint32_t IManager::getFunctionCount ()
+{
+  FunctionTable &table = functionTable ();
+  std::lock_guard<std::mutex> lock (table.mutex);
+
+  return (uint32_t)table.names.size () - 1;
+}
+
+void IManager::setThreadName (const std::string &name)
+{
+  ThreadInfo::setThreadName (name);
+}
+
+std::string IManager::getThreadName (int tid)
+{
+  return ThreadInfo::getThreadName (tid);
+}
+
 /**
 \brief Return initial timestamp of tracing
  */
@@ -151,9 +307,8 @@ IModule *Manager::findModule (const std::string &name) const
 std::list<std::weak_ptr<IOutput>> Manager::getOutputs ()
 {
   std::list<std::weak_ptr < IOutput>> ret;
-  // Make copy of the list
-  std::lock_guard<std::mutex> lock (m_outputsMutex);
-  for (std::list<output_ptr>::iterator it = m_outputs.begin (); it != m_outputs.end (); ++it)
+  output_set_ptr outputs = currentOutputs ();
+  for (std::vector<output_ptr>::const_iterator it = outputs->outputs.begin (); it != outputs->outputs.end (); ++it)
   {
     ret.push_back (*it);
   }
@@ -165,25 +320,82 @@ void Manager::addOutput (IOutput *out)
   std::shared_ptr<IOutput> ptr;
   ptr.reset (out);
   std::lock_guard<std::mutex> lock (m_outputsMutex);
-  m_outputs.push_back (ptr);
+  std::shared_ptr<OutputSet> outputs = std::make_shared<OutputSet> (*currentOutputs ());
+  outputs->outputs.push_back (ptr);
+  if (OutputThreads == outputs->deliveryMode)
+  {
+    outputs->workers.push_back (std::make_shared<OutputWorker> (ptr, outputs->outputQueueSize));
+  }
+  publishOutputs (outputs);
   start (); // start output loop if not already busy
 }
 
+/**
+\brief Remove output object
+
+Does not wait for the output thread: a delivery that is in progress may still
+hand its messages to the output, which is released after that.
+ */
 void Manager::removeOutput (IOutput *out)
 {
-  std::lock_guard<std::mutex> lock (m_outputsMutex);
-  std::list<output_ptr>::iterator it = m_outputs.begin ();
-  while (it != m_outputs.end ())
+  std::vector<output_worker_ptr> removed;
   {
-    if ((*it).get () == out)
+    std::lock_guard<std::mutex> lock (m_outputsMutex);
+    std::shared_ptr<OutputSet> outputs = std::make_shared<OutputSet> (*currentOutputs ());
+    for (std::vector<output_worker_ptr>::iterator it = outputs->workers.begin (); it != outputs->workers.end (); )
     {
-      it = m_outputs.erase (it);
+      if ((*it)->getOutput ().get () == out)
+      {
+        removed.push_back (*it);
+        it = outputs->workers.erase (it);
+      }
+      else
+      {
+        ++it;
+      }
     }
-    else
+    std::vector<output_ptr>::iterator it = outputs->outputs.begin ();
+    while (it != outputs->outputs.end ())
     {
-      ++it;
+      if ((*it).get () == out)
+      {
+        it = outputs->outputs.erase (it);
+      }
+      else
+      {
+        ++it;
+      }
     }
+    publishOutputs (outputs);
   }
+
+  // Let its worker write what it has; other changes need not wait for that
+  for (std::vector<output_worker_ptr>::iterator wit = removed.begin (); wit != removed.end (); ++wit)
+  {
+    (*wit)->stop ();
+  }
+}
+
+/**
+\brief Return the current set of outputs
+
+The set is never modified; changes are made to a copy that replaces it.
+ */
+Manager::output_set_ptr Manager::currentOutputs () const
+{
+  return std::atomic_load (&m_outputSet);
+}
+
+/**
+\brief Make a new set of outputs current
+
+Must be called with m_outputsMutex locked. The output thread picks up the new
+set at the start of its next pass.
+ */
+void Manager::publishOutputs (const std::shared_ptr<OutputSet> &set)
+{
+  output_set_ptr outputs = set;
+  std::atomic_store (&m_outputSet, outputs);
 }
 
 /**
@@ -191,17 +403,314 @@ void Manager::removeOutput (IOutput *out)
  */
 void Manager::pushMessage (const Message &msg)
 {
-  // Just a quick lock
-  m_messagesMutex.lock ();
-  m_messages.push_back (msg);
-  // Check if our queue gets too big; prune old messages
-  if (m_messages.size () > 1000)
+  pushMessage (Message (msg));
+}
+
+void Manager::pushMessage (Message &&msg)
+{
+  size_t waiting = 0;
+  if (ThreadQueues == m_queueMode.load (std::memory_order_relaxed))
+  {
+    waiting = pushThreadQueue (std::move (msg));
+  }
+  else
+  {
+    waiting = pushShared (std::move (msg));
+  }
+  // Only wake up the output thread when the queue was empty (it may be asleep) or
+  // when a batch has built up; otherwise it is busy or will come round soon enough.
+  if (1 == waiting || (waiting > 0 && 0 == waiting % s_wakeupBatch))
+  {
+    m_messagesAvailable.notify ();
+  }
+}
+
+/**
+\brief Return the overflow policy that applies to a message
+
+The output thread never blocks, since nobody would make room for it.
+ */
+IManager::OverflowPolicy Manager::effectivePolicy (const Message &msg) const
+{
+  OverflowPolicy policy = m_overflowPolicy.load (std::memory_order_relaxed);
+  if ((Block == policy || BlockErrors == policy) && s_isOutputThread)
+  {
+    return DropNewest;
+  }
+  if (BlockErrors == policy && Message::Error != msg.type)
+  {
+    return DropNewest;
+  }
+  return policy;
+}
+
+/**
+\brief Check if a message of \p bytes fits in the shared queue
+
+Must be called with m_messagesMutex locked. An empty queue always accepts a message.
+ */
+bool Manager::sharedQueueFull (size_t bytes) const
+{
+  if (m_messages.empty ())
+  {
+    return false;
+  }
+  size_t max_bytes = m_maxBytes.load (std::memory_order_relaxed);
+  return m_messages.size () >= m_maxMessages.load (std::memory_order_relaxed) ||
+    m_messages.size () >= m_messages.capacity () ||
+    (max_bytes > 0 && m_queuedBytes + bytes > max_bytes);
+}
+
+/**
+\brief Add message to the shared queue
+\return Number of messages in the queue afterwards; 0 if the message was dropped
+ */
+size_t Manager::pushShared (Message &&msg)
+{
+  const size_t bytes = msg.message.size ();
+  const OverflowPolicy configured = m_overflowPolicy.load (std::memory_order_relaxed);
+
+  std::unique_lock<std::mutex> lock (m_messagesMutex);
+  if (sharedQueueFull (bytes))
+  {
+    switch (effectivePolicy (msg))
+    {
+      case DropOldest:
+      {
+        Message old;
+        while (sharedQueueFull (bytes) && m_messages.pop (old))
+        {
+          m_queuedBytes -= old.message.size ();
+          m_dropped[configured]++;
+        }
+        break;
+      }
+      case DropNewest:
+        m_dropped[configured]++;
+        return 0;
+      case Block:
+      case BlockErrors:
+      {
+        m_blockedProducers++;
+        bool room = m_spaceAvailable.wait_for (lock, std::chrono::milliseconds (m_blockTimeout.load ()),
+          [this, bytes] { return !sharedQueueFull (bytes) || m_endLoop; });
+        m_blockedProducers--;
+        // At shutdown the wait ends while the queue may still be full
+        if (!room || sharedQueueFull (bytes))
+        {
+          m_dropped[configured]++;
+          return 0;
+        }
+        break;
+      }
+    }
+  }
+  if (!m_messages.push (std::move (msg)))
+  {
+    // Not expected after the checks above; the oldest message was overwritten. Its
+    // bytes stay counted until the output thread takes the queue.
+    m_dropped[configured]++;
+  }
+  m_queuedBytes += bytes;
+  m_sharedCount = m_messages.size ();
+  return m_messages.size ();
+}
+
+/**
+\brief Add message to the ring of the calling thread
+\return Number of messages in the ring afterwards; 0 if the message was dropped
+ */
+size_t Manager::pushThreadQueue (Message &&msg)
+{
+  const size_t bytes = msg.message.size ();
+  const OverflowPolicy configured = m_overflowPolicy.load (std::memory_order_relaxed);
+  const OverflowPolicy policy = effectivePolicy (msg);
+  ThreadQueue *queue = getThreadQueue ();
+  std::chrono::steady_clock::time_point deadline;
+
+  if (Block == policy || BlockErrors == policy)
+  {
+    deadline = std::chrono::steady_clock::now () + std::chrono::milliseconds (m_blockTimeout.load ());
+  }
+  for (;;)
+  {
+    // Claim the bytes first, so the output thread never sees the total go below zero
+    size_t max_bytes = m_maxBytes.load (std::memory_order_relaxed);
+    size_t queued = m_threadQueueBytes.fetch_add (bytes, std::memory_order_relaxed);
+    if ((0 == max_bytes || 0 == queued || queued + bytes <= max_bytes) && queue->ring.push (std::move (msg)))
+    {
+      return queue->ring.size ();
+    }
+    m_threadQueueBytes.fetch_sub (bytes, std::memory_order_relaxed);
+
+    if ((Block != policy && BlockErrors != policy) || std::chrono::steady_clock::now () >= deadline)
+    {
+      m_dropped[configured]++;
+      return 0;
+    }
+    // The ring has no way to signal room, so give the output thread a moment
+    m_messagesAvailable.notify ();
+    std::this_thread::sleep_for (std::chrono::microseconds (100));
+  }
+}
+
+void Manager::setQueueMode (QueueMode mode)
+{
+  m_queueMode = mode;
+}
+
+void Manager::setQueueLimits (size_t max_messages, size_t max_bytes)
+{
+  if (0 == max_messages)
+  {
+    max_messages = 1;
+  }
+
+  // Allocate outside the lock; only the queue is ever replaced by a bigger one
+  std::unique_ptr<CircularQueue<Message>> bigger;
+  if (max_messages > m_maxMessages.load ())
+  {
+    bigger.reset (new CircularQueue<Message> (max_messages));
+  }
+
+  std::lock_guard<std::mutex> lock (m_messagesMutex);
+  if (bigger && bigger->capacity () > m_messages.capacity ())
+  {
+    Message msg;
+    while (m_messages.pop (msg))
+    {
+      bigger->push (std::move (msg));
+    }
+    m_messages.swap (*bigger);
+  }
+  m_maxMessages = max_messages;
+  m_maxBytes = max_bytes;
+  m_spaceAvailable.notify_all ();
+}
+
+void Manager::setOverflowPolicy (OverflowPolicy policy, unsigned int timeout_ms)
+{
+  m_overflowPolicy = policy;
+  m_blockTimeout = timeout_ms;
+}
+
+/**
+\brief Switch between direct delivery and a thread per output
+
+The old workers write what they have before the new set is published, so an
+output is never written by two threads at once.
+ */
+void Manager::setDeliveryMode (DeliveryMode mode, size_t max_messages_per_output)
+{
+  std::lock_guard<std::mutex> lock (m_outputsMutex);
+  if (0 == max_messages_per_output)
+  {
+    max_messages_per_output = 1;
+  }
+  output_set_ptr old_outputs = currentOutputs ();
+  if (mode == old_outputs->deliveryMode && max_messages_per_output == old_outputs->outputQueueSize)
+  {
+    return;
+  }
+
+  // Batches that still arrive at a finished worker are written by the output thread itself
+  for (std::vector<output_worker_ptr>::const_iterator it = old_outputs->workers.begin (); it != old_outputs->workers.end (); ++it)
+  {
+    (*it)->stop ();
+  }
+
+  std::shared_ptr<OutputSet> outputs = std::make_shared<OutputSet> ();
+  outputs->outputs = old_outputs->outputs;
+  outputs->deliveryMode = mode;
+  outputs->outputQueueSize = max_messages_per_output;
+  if (OutputThreads == mode)
+  {
+    // The output thread hands nothing to the new workers until it has finished its
+    // current pass, and they do not call IOutput::idle() before it activates them
+    // in the next one, so they never write at the same time as direct delivery
+    for (std::vector<output_ptr>::const_iterator it = outputs->outputs.begin (); it != outputs->outputs.end (); ++it)
+    {
+      outputs->workers.push_back (std::make_shared<OutputWorker> (*it, max_messages_per_output));
+    }
+  }
+  publishOutputs (outputs);
+}
+
+IManager::DeliveryMode Manager::getDeliveryMode () const
+{
+  return currentOutputs ()->deliveryMode;
+}
+
+unsigned long Manager::getOutputDroppedMessages (const IOutput *out) const
+{
+  output_set_ptr outputs = currentOutputs ();
+  for (std::vector<output_worker_ptr>::const_iterator it = outputs->workers.begin (); it != outputs->workers.end (); ++it)
+  {
+    if ((*it)->getOutput ().get () == out)
+    {
+      return (*it)->getDropped ();
+    }
+  }
+  return 0;
+}
+
+IManager::OverflowPolicy Manager::getOverflowPolicy () const
+{
+  return m_overflowPolicy.load ();
+}
+
+unsigned long Manager::getDroppedMessages (OverflowPolicy policy) const
+{
+  if (policy < DropOldest || policy > BlockErrors)
+  {
+    return 0;
+  }
+  return m_dropped[policy].load ();
+}
+
+IManager::QueueMode Manager::getQueueMode () const
+{
+  return m_queueMode;
+}
+
+void Manager::setDeferredFormatting (bool enable)
+{
+  m_deferredFormatting = enable;
+}
+
+bool Manager::getDeferredFormatting () const
+{
+  return m_deferredFormatting.load (std::memory_order_relaxed);
+}
+
+bool Manager::setClockSource (ClockSource source)
+{
+  return Clock::setTscEnabled (TscClock == source);
+}
+
+IManager::ClockSource Manager::getClockSource () const
+{
+  return Clock::tscEnabled () ? TscClock : SystemClock;
+}
+
+/**
+\brief Return the ring of the calling thread
+
+The ring is created and registered on first use. A ring left over from
+a previous manager instance is abandoned and replaced.
+ */
+ThreadQueue *Manager::getThreadQueue ()
+{
+  ThreadQueue *queue = s_threadQueue.queue.get ();
+  if (nullptr == queue || queue->generation != m_generation)
   {
-    m_messages.pop_front ();
+    s_threadQueue.queue = std::make_shared<ThreadQueue> (m_generation, m_maxMessages.load ());
+    queue = s_threadQueue.queue.get ();
+
+    std::lock_guard<std::mutex> lock (m_threadQueuesMutex);
+    m_threadQueues.push_back (s_threadQueue.queue);
   }
-  m_messagesMutex.unlock ();
-  // Wake up any waiting output
-  m_messagesAvailable.notify_all ();
+  return queue;
 }
 
 void Manager::enableDebugOutput ()
@@ -233,45 +742,311 @@ void Manager::stop ()
 {
   if (m_outputThread.joinable () && !m_endLoop)
   {
-    m_endLoop = true;
-    // trigger lock
-    m_messagesAvailable.notify_all ();
+    {
+      // Set under the lock so blocked producers cannot miss it
+      std::lock_guard<std::mutex> lock (m_messagesMutex);
+      m_endLoop = true;
+    }
+    m_spaceAvailable.notify_all ();
+    m_messagesAvailable.notify ();
     m_outputThread.join ();
+
+    // Everything has been handed to the outputs; wait until they have written it
+    output_set_ptr outputs = currentOutputs ();
+    for (std::vector<output_worker_ptr>::const_iterator it = outputs->workers.begin (); it != outputs->workers.end (); ++it)
+    {
+      (*it)->stop ();
+    }
   }
 }
 
 /**
 \brief Background thread to write messages
+
+Keeps running until stop() is called; any messages still queued at that
+moment are delivered before the thread ends.
  */
 void Manager::outputLoop ()
 {
-  std::unique_lock<std::mutex> lock (m_messagesMutex);
-  while (!m_endLoop)
+  s_isOutputThread = true;
+  for (;;)
   {
-    // Wait until there are messages available.
-    m_messagesAvailable.wait (lock);
+    // Read the flag first, so everything pushed before stop() gets delivered
+    bool stopping = m_endLoop;
 
-    // Do not allow manipulation of outputs while we are processing messages
-    m_outputsMutex.lock ();
-    while (!m_messages.empty ())
+    if (m_tscCalibration && std::chrono::steady_clock::now () - m_lastCalibration > s_calibrationInterval)
     {
-      Message msg = m_messages.front ();
-      m_messages.pop_front ();
-      // Unlock the messages queue for writing 
-      m_messagesMutex.unlock ();
+      m_tscCalibration->recalibrate ();
+      m_lastCalibration = std::chrono::steady_clock::now ();
+    }
 
-      // We have our message, we can now (slowly) process it
-      for (std::list<output_ptr>::iterator it = m_outputs.begin (); it != m_outputs.end (); ++it)
-      {
-        (*it)->saveMessage (msg);
-      }
-      // Re-lock because condition_variable expects that
-      m_messagesMutex.lock ();
+    // Hold on to one set of outputs for the whole pass; changes take effect in the next one
+    size_t delivered = 0;
+    m_deliverySet = currentOutputs ();
+    // The previous pass may have written to the outputs directly; it is over now
+    for (std::vector<output_worker_ptr>::const_iterator it = m_deliverySet->workers.begin (); it != m_deliverySet->workers.end (); ++it)
+    {
+      (*it)->activate ();
+    }
+    delivered += drainSharedQueue ();
+    delivered += drainThreadQueues ();
+    if (0 == delivered && std::chrono::steady_clock::now () - m_lastIdle >= s_pollInterval)
+    {
+      idleOutputs ();
+      m_lastIdle = std::chrono::steady_clock::now ();
+    }
+    m_deliverySet.reset ();
+    if (stopping)
+    {
+      break;
+    }
+    if (0 == delivered)
+    {
+      waitForMessages ();
     }
-    m_outputsMutex.unlock ();
   }
 }
 
+/**
+\brief Check if there is anything to deliver
+
+Does not take the lock of the shared queue; the answer may be out of date by the
+time the caller acts on it, which is fine for deciding whether to go to sleep.
+ */
+bool Manager::haveMessages ()
+{
+  if (m_sharedCount.load () > 0 || m_endLoop)
+  {
+    return true;
+  }
+  std::lock_guard<std::mutex> lock (m_threadQueuesMutex);
+  for (std::list<thread_queue_ptr>::iterator it = m_threadQueues.begin (); it != m_threadQueues.end (); ++it)
+  {
+    if (!(*it)->ring.empty ())
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+\brief Wait until there are new messages
+
+Looks for messages a number of times first, since under load the next message
+usually arrives within microseconds and sleeping would only cost a wakeup. After
+that it sleeps on the event count, for at most s_pollInterval.
+ */
+void Manager::waitForMessages ()
+{
+  for (int i = 0; i < s_spinCount; i++)
+  {
+    if (haveMessages ())
+    {
+      return;
+    }
+    std::this_thread::yield ();
+  }
+
+  EventCount::Key key = m_messagesAvailable.prepareWait ();
+  if (haveMessages ())
+  {
+    m_messagesAvailable.cancelWait ();
+    return;
+  }
+  m_messagesAvailable.wait (key, s_pollInterval);
+}
+
+/**
+\brief Deliver all messages from the shared queue
+\return Number of messages delivered
+
+Swaps the queue with an empty one under a single lock, so the producers can go on
+while the batch is written. Note that the messages being written no longer count
+towards the queue limits.
+ */
+size_t Manager::drainSharedQueue ()
+{
+  {
+    // Take the whole queue at once and give the producers an empty one
+    std::unique_lock<std::mutex> lock (m_messagesMutex);
+    if (m_messages.empty ())
+    {
+      return 0;
+    }
+    while (m_spareMessages.capacity () != m_messages.capacity ())
+    {
+      // setQueueLimits() has grown the queue; allocating the spare can take a
+      // while for a large queue, so do not hold up the producers meanwhile
+      size_t capacity = m_messages.capacity ();
+      lock.unlock ();
+      m_spareMessages = CircularQueue<Message> (capacity);
+      lock.lock ();
+    }
+    m_messages.swap (m_spareMessages);
+    m_sharedCount = 0;
+    m_queuedBytes = 0;
+    if (m_blockedProducers > 0)
+    {
+      m_spaceAvailable.notify_all ();
+    }
+  }
+
+  // We have our messages, we can now (slowly) process them
+  size_t count = m_spareMessages.size ();
+  reportDropped ();
+  m_spareMessages.forEachRange ([this] (Message *begin, Message *end) { deliverMessages (begin, end); });
+  m_spareMessages.clear ();
+  return count;
+}
+/**
+\brief Deliver messages from the per-thread rings
+
+Collects the content of all rings, sorts it on timestamp and sends it to the outputs.
+Rings of threads that have exited are removed once they are empty.
+\return Number of messages delivered
+ */
+size_t Manager::drainThreadQueues ()
+{
+  std::list<thread_queue_ptr> queues;
+  {
+    std::lock_guard<std::mutex> lock (m_threadQueuesMutex);
+    queues = m_threadQueues;
+  }
+
+  Message msg;
+  for (std::list<thread_queue_ptr>::iterator it = queues.begin (); it != queues.end (); ++it)
+  {
+    // Check before draining; after the flag is set there will be no more messages
+    bool closed = (*it)->closed.load (std::memory_order_acquire);
+    while ((*it)->ring.pop (msg))
+    {
+      m_threadQueueBytes.fetch_sub (msg.message.size (), std::memory_order_relaxed);
+      resolveTimestamp (msg);
+      m_mergeBuffer.push_back (std::move (msg));
+    }
+    if (closed)
+    {
+      std::lock_guard<std::mutex> lock (m_threadQueuesMutex);
+      m_threadQueues.remove (*it);
+    }
+  }
+
+  reportDropped ();
+  // Each ring is in order already, so a stable sort keeps per-thread order intact
+  std::stable_sort (m_mergeBuffer.begin (), m_mergeBuffer.end (),
+    [] (const Message &a, const Message &b) { return a.timestamp < b.timestamp; });
+  size_t count = m_mergeBuffer.size ();
+  if (count > 0)
+  {
+    deliverMessages (m_mergeBuffer.data (), m_mergeBuffer.data () + count);
+  }
+  m_mergeBuffer.clear ();
+  return count;
+}
+
+/**
+\brief Tell the outputs about messages that were lost
+
+Sends a single Error message with the number of messages dropped since the
+last report, if any.
+ */
+void Manager::reportDropped ()
+{
+  unsigned long total = 0;
+  for (int i = DropOldest; i <= BlockErrors; i++)
+  {
+    total += m_dropped[i].load (std::memory_order_relaxed);
+  }
+  if (total == m_droppedReported)
+  {
+    return;
+  }
+
+  Message marker = Message::droppedMarker (total - m_droppedReported);
+  m_droppedReported = total;
+  deliverMessage (marker);
+}
+
+/**
+\brief Convert a raw TSC timestamp to real time
+
+Only called on the output thread, which owns the calibration.
+ */
+void Manager::resolveTimestamp (Message &msg)
+{
+  if (!msg.timestamp.isRaw ())
+  {
+    return;
+  }
+  if (!m_tscCalibration)
+  {
+    m_tscCalibration.reset (new TscCalibration);
+    m_lastCalibration = std::chrono::steady_clock::now ();
+  }
+  msg.timestamp = m_tscCalibration->convert (msg.timestamp.getTicks ());
+}
+
+/**
+\brief Send single message to all outputs
+
+Only called on the output thread, during a pass.
+ */
+void Manager::deliverMessage (Message &msg)
+{
+  deliverMessages (&msg, &msg + 1);
+}
+
+/**
+\brief Send a batch of messages to all outputs
+
+Completes the timestamps and deferred formatting first, then hands the whole
+batch to each output. In OutputThreads mode the messages are moved into a
+single shared batch that is queued for each worker.
+Only called on the output thread, during a pass.
+ */
+void Manager::deliverMessages (Message *begin, Message *end)
+{
+  for (Message *msg = begin; msg != end; ++msg)
+  {
+    resolveTimestamp (*msg);
+    msg->expand ();
+  }
+
+  const OutputSet &outputs = *m_deliverySet;
+  if (!outputs.workers.empty ())
+  {
+    std::shared_ptr<std::vector<Message>> batch = std::make_shared<std::vector<Message>> (std::make_move_iterator (begin), std::make_move_iterator (end));
+    for (std::vector<output_worker_ptr>::const_iterator it = outputs.workers.begin (); it != outputs.workers.end (); ++it)
+    {
+      (*it)->push (batch);
+    }
+    return;
+  }
+  for (std::vector<output_ptr>::const_iterator it = outputs.outputs.begin (); it != outputs.outputs.end (); ++it)
+  {
+    (*it)->saveMessages (begin, end);
+  }
+}
+
+/**
+\brief Tell the outputs that there is nothing to deliver
+
+In the OutputThreads mode the workers do this themselves, so that idle() is
+always called by the thread that writes to the output.
+ */
+void Manager::idleOutputs ()
+{
+  const OutputSet &outputs = *m_deliverySet;
+  if (!outputs.workers.empty ())
+  {
+    return;
+  }
+  for (std::vector<output_ptr>::const_iterator it = outputs.outputs.begin (); it != outputs.outputs.end (); ++it)
+  {
+    (*it)->idle ();
+  }
+}
 
 #if 0
 
@@ -1,15 +1,18 @@
 #pragma once
 
+#include <chrono>
 #include <condition_variable>
-#include <deque>
 #include <list>
 #include <map>
 #include <string>
+#include <vector>
 
 #include <atomic>
 #include <mutex>
 #include <thread>
 
+#include "circular_queue.h"
+#include "event_count.h"
 #include "interfaces.h"
 #include "timestamp.h"
 
@@ -17,6 +20,9 @@ namespace NTrace
 {
 
 class Module;
+class OutputWorker;
+class TscCalibration;
+struct ThreadQueue;
 
 /**
 \brief Instance of central logging manager
@@ -33,6 +39,19 @@ program while some output may take a while to process.
 
 class Manager: public IManager
 {
+  // Output objects. The current set is an immutable snapshot that is replaced
+  // as a whole; the output thread picks it up without locking.
+  typedef std::shared_ptr<IOutput> output_ptr;
+  typedef std::shared_ptr<OutputWorker> output_worker_ptr;
+  struct OutputSet
+  {
+    std::vector<output_ptr> outputs;
+    std::vector<output_worker_ptr> workers; ///< One per output in OutputThreads mode
+    DeliveryMode deliveryMode;
+    size_t outputQueueSize;
+  };
+  typedef std::shared_ptr<const OutputSet> output_set_ptr;
+
 public:
   Manager ();
   ~Manager ();
@@ -49,6 +68,20 @@ public:
   virtual void NTRACE_CALL removeOutput (IOutput *out);
 
   virtual void NTRACE_CALL pushMessage (const Message &msg);
+  virtual void NTRACE_CALL pushMessage (Message &&msg);
+  virtual void NTRACE_CALL setQueueMode (QueueMode mode);
+  virtual QueueMode NTRACE_CALL getQueueMode () const;
+  virtual void NTRACE_CALL setQueueLimits (size_t max_messages, size_t max_bytes);
+  virtual void NTRACE_CALL setOverflowPolicy (OverflowPolicy policy, unsigned int timeout_ms);
+  virtual OverflowPolicy NTRACE_CALL getOverflowPolicy () const;
+  virtual unsigned long NTRACE_CALL getDroppedMessages (OverflowPolicy policy) const;
+  virtual void NTRACE_CALL setDeliveryMode (DeliveryMode mode, size_t max_messages_per_output);
+  virtual DeliveryMode NTRACE_CALL getDeliveryMode () const;
+  virtual unsigned long NTRACE_CALL getOutputDroppedMessages (const IOutput *out) const;
+  virtual void NTRACE_CALL setDeferredFormatting (bool enable);
+  virtual bool NTRACE_CALL getDeferredFormatting () const;
+  virtual bool NTRACE_CALL setClockSource (ClockSource source);
+  virtual ClockSource NTRACE_CALL getClockSource () const;
 
   virtual void NTRACE_CALL enableDebugOutput ();
 
@@ -62,7 +95,26 @@ protected:
   void start ();
   void stop ();
 
+  output_set_ptr currentOutputs () const;
+  void publishOutputs (const std::shared_ptr<OutputSet> &set);
+
   void outputLoop ();
+  void waitForMessages ();
+  bool haveMessages ();
+  size_t drainSharedQueue ();
+  size_t drainThreadQueues ();
+  void deliverMessage (Message &msg);
+  void deliverMessages (Message *begin, Message *end);
+  void idleOutputs ();
+  void resolveTimestamp (Message &msg);
+  void reportDropped ();
+
+  size_t pushShared (Message &&msg);
+  size_t pushThreadQueue (Message &&msg);
+  bool sharedQueueFull (size_t bytes) const;
+  OverflowPolicy effectivePolicy (const Message &msg) const;
+
+  ThreadQueue *getThreadQueue ();
 
 private:
   // Our modules
@@ -71,17 +123,43 @@ private:
   std::mutex m_modulesMutex;
 
   // Output objects
-  typedef std::shared_ptr<IOutput> output_ptr;
-  std::list<output_ptr> m_outputs;
-  std::mutex m_outputsMutex;
+  output_set_ptr m_outputSet; ///< Only accessed through std::atomic_load/atomic_store
+  std::mutex m_outputsMutex;  ///< Serializes changes to m_outputSet
+  output_set_ptr m_deliverySet; ///< Snapshot used during one pass; output thread only
 
   // The messages
-  std::deque<Message> m_messages;
+  CircularQueue<Message> m_messages;
+  CircularQueue<Message> m_spareMessages; ///< Swapped with m_messages; only used by the output thread
   std::mutex m_messagesMutex;
-  std::condition_variable m_messagesAvailable;
+  std::atomic<size_t> m_sharedCount; ///< Number of messages in m_messages, readable without the lock
+  EventCount m_messagesAvailable;
+  std::condition_variable m_spaceAvailable; ///< Signalled when blocked producers are waiting
+  unsigned int m_blockedProducers;
+  size_t m_queuedBytes;  ///< Size of the text in m_messages
+
+  // Queue limits and overflow handling
+  std::atomic<size_t> m_maxMessages;
+  std::atomic<size_t> m_maxBytes;
+  std::atomic<size_t> m_threadQueueBytes; ///< Size of the text in all per-thread rings
+  std::atomic<OverflowPolicy> m_overflowPolicy;
+  std::atomic<unsigned int> m_blockTimeout; ///< In milliseconds
+  std::atomic<unsigned long> m_dropped[BlockErrors + 1];
+  unsigned long m_droppedReported; ///< Total that the outputs have been told about
+
+  // Per-thread rings, used in ThreadQueues mode
+  typedef std::shared_ptr<ThreadQueue> thread_queue_ptr;
+  std::list<thread_queue_ptr> m_threadQueues;
+  std::mutex m_threadQueuesMutex;
+  std::atomic<QueueMode> m_queueMode;
+  unsigned int m_generation; ///< Distinguishes our rings from those of a previous manager instance
+  std::vector<Message> m_mergeBuffer; ///< Messages collected from the rings, to be sorted
 
   std::thread m_outputThread;
   std::atomic<bool> m_endLoop;
+  std::atomic<bool> m_deferredFormatting;
+  std::unique_ptr<TscCalibration> m_tscCalibration; ///< Created by the output thread when it first needs it
+  std::chrono::steady_clock::time_point m_lastCalibration;
+  std::chrono::steady_clock::time_point m_lastIdle; ///< Last time the outputs were told there was nothing to deliver
   //std::ostream *m_logStream;
   //bool m_ownLogStream;
 
@@ -1,29 +1,87 @@
-#if defined(_WIN32)
-#include <windows.h>
-#else
-// todo: HAVE_CONFIG_H and checks for pthread
-#include <pthread.h>
-#include <unistd.h>
-#endif
+#include <stdio.h>
 
+#include "clock.h"
+#include "deferred_format.h"
+#include "interfaces.h"
 #include "message.h"
+#include "thread_info.h"
 
 using namespace NTrace;
 
 /**
 \brief Constructor
 
-Sets the timestamp, process and thread ID
+Sets the timestamp, process and thread ID. The IDs come from ThreadInfo, so
+this does not need any system calls; the timestamp comes from Clock::now().
 */
 Message::Message ()
+  : module (nullptr), level (0), type (Normal), format (nullptr), functionId (0), site (nullptr), timestamp (Clock::now ())
 {
-#if defined(_WIN32)
-  pid = (int)::GetCurrentProcessId ();
-  tid = (int)::GetCurrentThreadId ();
-#else
-  pthread_t pt;
-  pid = getpid ();
-  pt = pthread_self ();
-  tid = (int)pt;
-#endif
+  pid = ThreadInfo::getProcessId ();
+  tid = ThreadInfo::getThreadId ();
+}
+
+/**
+\brief Constructor for a message from an input
+\param source The input that generates the message
+ */
+Message::Message (const IInput *source)
+  : module (source), level (0), type (Normal), format (nullptr), functionId (0), site (nullptr), timestamp (Clock::now ())
+{
+  pid = ThreadInfo::getProcessId ();
+  tid = ThreadInfo::getThreadId ();
+}
+
+
+/**
+\brief Create the message that tells outputs that messages were lost
+\param count Number of messages dropped
+
+This is an Error message without module, stamped with the current (monotonic) time.
+*/
+Message Message::droppedMarker (unsigned long count)
+{
+  Message marker;
+  char text[64];
+
+  snprintf (text, sizeof (text), "%lu messages dropped", count);
+  marker.module = nullptr;
+  marker.level = 0;
+  marker.type = Error;
+  marker.message = text;
+  marker.timestamp = Timestamp::now (Timestamp::Monotonic);
+  return marker;
+}
+
+/**
+\brief Complete a message on the output thread
+
+Formats any captured arguments (see DeferredFormat) and replaces them with
+the resulting text. Does nothing if the message is complete already.
+
+Called by the manager before the message is passed to the outputs.
+*/
+void Message::expand ()
+{
+  // Only used on the output thread; keeps its capacity between messages
+  static thread_local std::string text;
+
+  if (nullptr != format)
+  {
+    text.clear ();
+    DeferredFormat::expand (text, format, message);
+    message.assign (text.data (), text.size ());
+    format = nullptr;
+  }
+}
+
+/**
+\brief Return the name of the function of an Entry or Exit message
+
+Resolves \ref functionId through the function name table; returns a null pointer
+if the message does not refer to a function.
+*/
+const char *Message::getFunctionName () const
+{
+  return IManager::getFunctionName (functionId);
 }
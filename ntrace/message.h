@@ -1,13 +1,16 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 
+#include "payload.h"
 #include "timestamp.h"
 
 namespace NTrace
 {
 
 class IInput;
+struct CallSite;
 
 /**
 \brief A single log message
@@ -32,16 +35,33 @@ public:
     Exit,         // Function exit messages
     User = 100,   // Startvalue for User-defined log messages
   } type;
-  /// The message
-  std::string message;
+  /**
+   \brief The message; for Entry messages the arguments of the function, if any
+
+   While \ref format is set, this holds the arguments captured by DeferredFormat
+   instead; expand() replaces them with the formatted text.
+   */
+  Payload message;
+  /// Format string for deferred formatting; null if \ref message is already complete
+  const char *format;
+  /// Function of Entry and Exit messages, as ID in the function name table; 0 if unknown
+  uint32_t functionId;
+  /// The statement that generated the message; null if it was not logged through a TR macro
+  const CallSite *site;
   /// When the message was generated
   Timestamp timestamp;
   /// Process ID
   int pid;
-  /// Thread ID
+  /// Thread ID; on Linux the kernel TID. See IManager::getThreadName()
   int tid;
 
   Message ();
+  explicit Message (const IInput *source);
+
+  static Message droppedMarker (unsigned long count);
+
+  void expand ();
+  const char *getFunctionName () const;
 };
 
 }
\ No newline at end of file
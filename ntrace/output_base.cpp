@@ -19,3 +19,48 @@ std::string OutputBase::getName () const
 {
   return m_name;
 }
+
+/**
+ \brief Return the text of a message as it should be written
+ \param msg The message
+
+ Entry and Exit messages only carry the ID of their function; this puts the
+ function name in front, with the arguments of an Entry between parentheses.
+ All other messages are returned as is.
+ */
+std::string OutputBase::getText (const Message &msg)
+{
+  std::string text;
+  appendText (msg, text);
+  return text;
+}
+
+/**
+ \brief Append the text of a message to a string
+ \param msg The message
+ \param out String to append to
+
+ Same as getText(), without creating a new string.
+ */
+void OutputBase::appendText (const Message &msg, std::string &out)
+{
+  const char *function = nullptr;
+
+  if (Message::Entry == msg.type || Message::Exit == msg.type)
+  {
+    function = msg.getFunctionName ();
+  }
+  if (nullptr == function)
+  {
+    out.append (msg.message.data (), msg.message.size ());
+    return;
+  }
+
+  out += function;
+  if (Message::Entry == msg.type && !msg.message.empty ())
+  {
+    out += " (";
+    out.append (msg.message.data (), msg.message.size ());
+    out += ")";
+  }
+}
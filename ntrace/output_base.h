@@ -14,6 +14,8 @@ class OutputBase : public IOutput
 public:
   virtual std::string NTRACE_CALL getName () const;
 
+  static void appendText (const Message &msg, std::string &out);
+
 protected:
   /**
    \brief Constructor without starting time
@@ -32,6 +34,8 @@ protected:
    relative timestamps) */
   OutputBase (const std::string &name, const Timestamp &start_time);
 
+  static std::string getText (const Message &msg);
+
   /// The starting timestamp
   const Timestamp m_startTime;
 
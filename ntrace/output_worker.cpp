@@ -0,0 +1,105 @@
+#include "output_worker.h"
+
+using namespace NTrace;
+
+/// How long the worker waits for a batch before it calls IOutput::idle()
+static const std::chrono::milliseconds s_idleInterval (10);
+
+/**
+  \brief Constructor; starts the thread
+  \param output The output to feed
+  \param max_messages Maximum number of messages waiting for this output
+ */
+OutputWorker::OutputWorker (const std::shared_ptr<IOutput> &output, size_t max_messages)
+  : m_output (output), m_maxMessages (max_messages), m_queuedMessages (0), m_stopping (false), m_finished (false),
+    m_active (false), m_dropped (0), m_droppedReported (0)
+{
+  m_thread = std::thread (&OutputWorker::run, this);
+}
+
+OutputWorker::~OutputWorker ()
+{
+  stop ();
+}
+
+/**
+  \brief Queue a batch for the output
+
+  Drops the batch if it does not fit, unless the queue is empty; a single batch
+  is always accepted.
+ */
+void OutputWorker::push (const message_batch_ptr &batch)
+{
+  {
+    std::unique_lock<std::mutex> lock (m_mutex);
+    if (m_finished)
+    {
+      // Nobody else writes to the output anymore
+      lock.unlock ();
+      m_output->saveMessages (batch->data (), batch->data () + batch->size ());
+      return;
+    }
+    if (m_queuedMessages > 0 && m_queuedMessages + batch->size () > m_maxMessages)
+    {
+      m_dropped.fetch_add (batch->size (), std::memory_order_relaxed);
+      return;
+    }
+    m_batches.push_back (batch);
+    m_queuedMessages += batch->size ();
+  }
+  m_available.notify_one ();
+}
+
+/**
+  \brief Write what is still queued, then end the thread
+ */
+void OutputWorker::stop ()
+{
+  if (!m_thread.joinable ())
+  {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock (m_mutex);
+    m_stopping = true;
+  }
+  m_available.notify_one ();
+  m_thread.join ();
+}
+
+void OutputWorker::run ()
+{
+  for (;;)
+  {
+    message_batch_ptr batch;
+    {
+      std::unique_lock<std::mutex> lock (m_mutex);
+      if (!m_available.wait_for (lock, s_idleInterval, [this] { return !m_batches.empty () || m_stopping; }))
+      {
+        lock.unlock ();
+        if (m_active.load (std::memory_order_acquire))
+        {
+          m_output->idle ();
+        }
+        continue;
+      }
+      if (m_batches.empty ())
+      {
+        m_finished = true;
+        break;
+      }
+      batch = m_batches.front ();
+      m_batches.pop_front ();
+      m_queuedMessages -= batch->size ();
+    }
+
+    unsigned long dropped = m_dropped.load (std::memory_order_relaxed);
+    if (dropped != m_droppedReported)
+    {
+      Message marker = Message::droppedMarker (dropped - m_droppedReported);
+      m_droppedReported = dropped;
+      m_output->saveMessage (marker);
+    }
+    m_output->saveMessages (batch->data (), batch->data () + batch->size ());
+  }
+}
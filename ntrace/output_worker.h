@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "interfaces.h"
+
+namespace NTrace
+{
+
+/// A batch of messages, shared by all output workers
+typedef std::shared_ptr<const std::vector<Message>> message_batch_ptr;
+
+/**
+  \brief Thread that feeds a single output
+
+  Used in the OutputThreads delivery mode. Each output gets its own worker with
+  a bounded queue, so an output that is slow (for example a file on a busy disk)
+  only holds up itself. The batches are shared between the workers; the last
+  worker to finish with a batch frees it.
+
+  When the queue is full, new batches are dropped for this output only; the output
+  is told how many messages it missed before it gets the next batch. When no
+  batch comes in for a while, the worker calls IOutput::idle(); but only after
+  activate(), since until then the output thread may still write to the output
+  directly.
+
+  Batches pushed after the worker has finished are written directly by the
+  calling thread; this happens when the output thread still works with an old
+  output set while the worker is being removed.
+*/
+class OutputWorker
+{
+public:
+  OutputWorker (const std::shared_ptr<IOutput> &output, size_t max_messages);
+  ~OutputWorker ();
+
+  void push (const message_batch_ptr &batch);
+  void stop ();
+
+  /// Called by the output thread once it works with the set of this worker
+  void activate ()
+  {
+    if (!m_active.load (std::memory_order_relaxed))
+    {
+      m_active.store (true, std::memory_order_release);
+    }
+  }
+
+  /// The output this worker feeds
+  const std::shared_ptr<IOutput> &getOutput () const
+  {
+    return m_output;
+  }
+
+  /// Number of messages this output has lost because its queue was full
+  unsigned long getDropped () const
+  {
+    return m_dropped.load (std::memory_order_relaxed);
+  }
+
+private:
+  void run ();
+
+  std::shared_ptr<IOutput> m_output;
+  const size_t m_maxMessages;
+
+  std::mutex m_mutex;
+  std::condition_variable m_available;
+  std::deque<message_batch_ptr> m_batches;
+  size_t m_queuedMessages; ///< Total number of messages in m_batches
+  bool m_stopping;
+  bool m_finished; ///< The thread has written its last batch
+  std::atomic<bool> m_active; ///< The output thread no longer writes to the output itself
+
+  std::atomic<unsigned long> m_dropped;
+  unsigned long m_droppedReported; ///< Only used by the worker thread
+
+  std::thread m_thread;
+};
+
+} // namespace
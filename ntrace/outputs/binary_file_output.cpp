@@ -0,0 +1,178 @@
+#include "../binary_format.h"
+#include "binary_file_output.h"
+
+
+using namespace NTrace;
+
+/// Write a new ClockRecord when the wall clock has moved this much against the monotonic clock
+static const int64_t s_clockTolerance = 1000000;
+
+/**
+\brief BinaryFileOutput constructor
+\param filename Name of the file; it is overwritten
+
+The file is opened when the first message arrives.
+ */
+BinaryFileOutput::BinaryFileOutput (const std::string &filename)
+  : OutputBase ("ntrace.binary_file_output"), m_filename (filename), m_failed (false),
+    m_clockOffset (0), m_lastNanos (0), m_batch (0)
+{
+}
+
+void BinaryFileOutput::saveMessage (const Message &msg)
+{
+  saveMessages (&msg, &msg + 1);
+}
+
+/**
+\brief Write a batch of messages
+
+The records of the batch are collected in a buffer and written at once.
+ */
+void BinaryFileOutput::saveMessages (const Message *begin, const Message *end)
+{
+  m_buffer.clear ();
+  if (!m_outStream.is_open ())
+  {
+    if (m_failed || !openOutputStream ())
+    {
+      return;
+    }
+  }
+
+  m_batch++;
+  writeClock ();
+  for (const Message *msg = begin; msg != end; ++msg)
+  {
+    writeNames (*msg);
+    writeMessage (*msg);
+  }
+  m_outStream.write (m_buffer.data (), m_buffer.size ());
+  m_outStream.flush ();
+}
+
+/**
+\brief Open the file and put the file header in the buffer
+ */
+bool BinaryFileOutput::openOutputStream ()
+{
+  m_outStream.open (m_filename.c_str (), std::ios::out | std::ios::trunc | std::ios::binary);
+  if (!m_outStream.is_open ())
+  {
+    m_failed = true;
+    return false;
+  }
+  m_buffer.append (BinaryFormat::magic (), BinaryFormat::s_magicLength);
+  m_buffer += (char)BinaryFormat::s_version;
+
+  // Make sure the first batch gets a clock record
+  m_clockOffset = 0;
+  return true;
+}
+
+/**
+\brief Write the current offset between the clocks, if it has changed
+ */
+void BinaryFileOutput::writeClock ()
+{
+  int64_t offset = Timestamp::now (Timestamp::Realtime).getNanos () - Timestamp::now (Timestamp::Monotonic).getNanos ();
+  int64_t change = offset - m_clockOffset;
+  if (change > -s_clockTolerance && change < s_clockTolerance)
+  {
+    return;
+  }
+  m_clockOffset = offset;
+  m_record.clear ();
+  BinaryFormat::putSigned (m_record, offset);
+  writeRecord (BinaryFormat::ClockRecord);
+}
+
+/**
+\brief Write the names a message refers to that are not in the file yet
+ */
+void BinaryFileOutput::writeNames (const Message &msg)
+{
+  if (msg.functionId != 0)
+  {
+    if (msg.functionId >= m_functionsWritten.size ())
+    {
+      m_functionsWritten.resize (msg.functionId + 1, false);
+    }
+    if (!m_functionsWritten[msg.functionId])
+    {
+      const char *name = msg.getFunctionName ();
+      writeName (BinaryFormat::FunctionRecord, msg.functionId, name ? name : "");
+      m_functionsWritten[msg.functionId] = true;
+    }
+  }
+
+  if (msg.module && m_moduleIds.find (msg.module) == m_moduleIds.end ())
+  {
+    uint32_t id = (uint32_t)m_moduleIds.size () + 1;
+    m_moduleIds[msg.module] = id;
+    writeName (BinaryFormat::ModuleRecord, id, msg.module->getName ());
+  }
+
+  // Thread names can change, so look again in every batch
+  ThreadState &thread = m_threads[msg.tid];
+  if (thread.checked != m_batch)
+  {
+    thread.checked = m_batch;
+    std::string name = IManager::getThreadName (msg.tid);
+    if (!name.empty () && name != thread.name)
+    {
+      thread.name = name;
+      m_record.clear ();
+      BinaryFormat::putVarint (m_record, (uint32_t)msg.pid);
+      BinaryFormat::putVarint (m_record, (uint32_t)msg.tid);
+      m_record += name;
+      writeRecord (BinaryFormat::ThreadRecord);
+    }
+  }
+}
+
+void BinaryFileOutput::writeName (int type, uint64_t id, const std::string &name)
+{
+  m_record.clear ();
+  BinaryFormat::putVarint (m_record, id);
+  m_record += name;
+  writeRecord (type);
+}
+
+void BinaryFileOutput::writeMessage (const Message &msg)
+{
+  // Timestamps are stored as monotonic time
+  int64_t nanos = msg.timestamp.getNanos ();
+  if (Timestamp::Realtime == msg.timestamp.getDomain ())
+  {
+    nanos -= m_clockOffset;
+  }
+
+  uint32_t module = 0;
+  if (msg.module)
+  {
+    module = m_moduleIds[msg.module];
+  }
+
+  m_record.clear ();
+  BinaryFormat::putSigned (m_record, nanos - m_lastNanos);
+  BinaryFormat::putVarint (m_record, (uint32_t)msg.pid);
+  BinaryFormat::putVarint (m_record, (uint32_t)msg.tid);
+  BinaryFormat::putSigned (m_record, msg.level);
+  BinaryFormat::putVarint (m_record, (uint32_t)msg.type);
+  BinaryFormat::putVarint (m_record, module);
+  BinaryFormat::putVarint (m_record, msg.functionId);
+  m_record.append (msg.message.data (), msg.message.size ());
+  writeRecord (BinaryFormat::MessageRecord);
+  m_lastNanos = nanos;
+}
+
+/**
+\brief Add the record in m_record to the buffer, with its length and type in front
+ */
+void BinaryFileOutput::writeRecord (int type)
+{
+  BinaryFormat::putVarint (m_buffer, m_record.size () + 1);
+  m_buffer += (char)type;
+  m_buffer += m_record;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <fstream>
+#include <unordered_map>
+#include <vector>
+
+#include "../interfaces.h"
+#include "../output_base.h"
+
+namespace NTrace
+{
+
+
+/**
+\brief Log output to a compact binary file
+
+Writes every message as a small binary record instead of a line of text: the
+timestamp as the difference with the previous message, the numbers as varints
+and the text as is. Module, function and thread names are written once, the
+first time a message refers to them. This takes a fraction of the time of
+formatting text and gives files about a third of the size.
+
+The files are converted to text (in the layout of FileOutput) or JSON with the
+ntrace-decode tool. The layout is described in BinaryFormat.
+
+getName() returns the fixed string "ntrace.binary_file_output".
+
+*/
+class BinaryFileOutput : public OutputBase
+{
+public:
+  NTRACE_EXPORT BinaryFileOutput (const std::string &filename);
+
+  virtual void NTRACE_CALL saveMessage (const Message &msg);
+  virtual void NTRACE_CALL saveMessages (const Message *begin, const Message *end);
+
+private:
+  bool openOutputStream ();
+  void writeClock ();
+  void writeMessage (const Message &msg);
+  void writeNames (const Message &msg);
+  void writeName (int type, uint64_t id, const std::string &name);
+  void writeRecord (int type);
+
+  std::string m_filename;
+  std::ofstream m_outStream;
+  bool m_failed;        ///< The file could not be opened; don't try again for every batch
+
+  std::string m_buffer; ///< Records of the current batch; keeps its capacity
+  std::string m_record; ///< Fields of the record being built
+
+  int64_t m_clockOffset;  ///< Last offset written in a ClockRecord
+  int64_t m_lastNanos;    ///< Timestamp of the previous message
+  unsigned long m_batch;
+
+  std::vector<bool> m_functionsWritten;
+  std::unordered_map<const IInput *, uint32_t> m_moduleIds;
+
+  /// Name of a thread as written to the file
+  struct ThreadState
+  {
+    std::string name;
+    unsigned long checked; ///< Batch in which the name was last looked up
+  };
+  std::unordered_map<int, ThreadState> m_threads;
+};
+
+}
@@ -0,0 +1,244 @@
+#if defined(_WIN32)
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#include "chrome_trace_output.h"
+
+
+using namespace NTrace;
+
+/**
+\brief ChromeTraceOutput constructor
+\param filename Name of the trace file, usually ending in .json; it is overwritten
+
+The file is opened when the first message arrives.
+ */
+ChromeTraceOutput::ChromeTraceOutput (const std::string &filename)
+  : OutputBase ("ntrace.chrome_trace_output"), m_filename (filename),
+    m_failed (false), m_firstEvent (true), m_batch (0)
+{
+}
+
+ChromeTraceOutput::~ChromeTraceOutput ()
+{
+  if (m_outStream.is_open ())
+  {
+    m_outStream << "\n]\n";
+    m_outStream.close ();
+  }
+}
+
+void ChromeTraceOutput::saveMessage (const Message &msg)
+{
+  saveMessages (&msg, &msg + 1);
+}
+
+/**
+\brief Write a batch of messages as events, followed by a flush
+ */
+void ChromeTraceOutput::saveMessages (const Message *begin, const Message *end)
+{
+  if (!m_outStream.is_open ())
+  {
+    if (m_failed)
+    {
+      return;
+    }
+    m_outStream.open (m_filename.c_str (), std::ios::out | std::ios::trunc | std::ios::binary);
+    if (!m_outStream.is_open ())
+    {
+      m_failed = true;
+      return;
+    }
+    m_outStream << "[";
+  }
+
+  m_batch++;
+  m_buffer.clear ();
+  for (const Message *msg = begin; msg != end; ++msg)
+  {
+    checkThreadName (*msg);
+    formatEvent (*msg);
+  }
+  m_outStream.write (m_buffer.data (), m_buffer.size ());
+  m_outStream.flush ();
+}
+
+/**
+\brief Start a new event in the buffer
+
+Events are separated by a comma before each event rather than after it, so the
+file never ends in a dangling comma.
+ */
+void ChromeTraceOutput::beginEvent ()
+{
+  m_buffer += m_firstEvent ? "\n{" : ",\n{";
+  m_firstEvent = false;
+}
+
+/**
+\brief Add a message to the buffer as an event
+ */
+void ChromeTraceOutput::formatEvent (const Message &msg)
+{
+  char buf[128];
+  int64_t nanos = msg.timestamp.getNanos ();
+
+  beginEvent ();
+  switch (msg.type)
+  {
+    case Message::Entry:
+      m_buffer += "\"ph\":\"B\",\"name\":";
+      m_buffer += "\"";
+      appendString (m_buffer, msg.getFunctionName (), strlen (msg.getFunctionName ()));
+      m_buffer += "\"";
+      break;
+    case Message::Exit:
+      m_buffer += "\"ph\":\"E\"";
+      break;
+    default:
+      m_buffer += "\"ph\":\"i\",\"s\":\"t\",\"name\":\"";
+      appendString (m_buffer, msg.message.data (), msg.message.size ());
+      m_buffer += "\"";
+      break;
+  }
+
+  snprintf (buf, sizeof (buf), ",\"ts\":%lld.%03d,\"pid\":%d,\"tid\":%d",
+    (long long)(nanos / 1000), (int)(nanos % 1000), msg.pid, msg.tid);
+  m_buffer += buf;
+
+  if (msg.module)
+  {
+    m_buffer += ",\"cat\":";
+    m_buffer += moduleName (msg.module);
+  }
+
+  switch (msg.type)
+  {
+    case Message::Entry:
+      if (!msg.message.empty ())
+      {
+        m_buffer += ",\"args\":{\"args\":\"";
+        appendString (m_buffer, msg.message.data (), msg.message.size ());
+        m_buffer += "\"}";
+      }
+      break;
+    case Message::Exit:
+      break;
+    case Message::Normal:
+      snprintf (buf, sizeof (buf), ",\"args\":{\"level\":%d", msg.level);
+      m_buffer += buf;
+      if (msg.module)
+      {
+        m_buffer += ",\"module\":";
+        m_buffer += moduleName (msg.module);
+      }
+      m_buffer += "}";
+      break;
+    case Message::Out:
+      m_buffer += ",\"args\":{\"type\":\"out\"}";
+      break;
+    case Message::Error:
+      m_buffer += ",\"args\":{\"type\":\"error\"}";
+      break;
+    default:
+      snprintf (buf, sizeof (buf), ",\"args\":{\"type\":%d}", (int)msg.type);
+      m_buffer += buf;
+      break;
+  }
+  m_buffer += "}";
+}
+
+/**
+\brief Write a metadata event when the name of the thread of a message has changed
+
+The name is looked up at most once per batch for each thread.
+ */
+void ChromeTraceOutput::checkThreadName (const Message &msg)
+{
+  std::pair<std::unordered_map<int, ThreadState>::iterator, bool> found = m_threads.insert (std::make_pair (msg.tid, ThreadState ()));
+  ThreadState &state = found.first->second;
+  if (!found.second && state.checked == m_batch)
+  {
+    return;
+  }
+  state.checked = m_batch;
+
+  std::string name = IManager::getThreadName (msg.tid);
+  if (name.empty () || name == state.name)
+  {
+    return;
+  }
+  state.name = name;
+
+  char buf[128];
+  beginEvent ();
+  snprintf (buf, sizeof (buf), "\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"", msg.pid, msg.tid);
+  m_buffer += buf;
+  appendString (m_buffer, name.data (), name.size ());
+  m_buffer += "\"}}";
+}
+
+/**
+\brief Return the name of a module as a JSON string, including the quotes
+ */
+const std::string &ChromeTraceOutput::moduleName (const IInput *module)
+{
+  std::unordered_map<const IInput *, std::string>::iterator it = m_moduleNames.find (module);
+  if (it == m_moduleNames.end ())
+  {
+    std::string name = module->getName ();
+    std::string quoted = "\"";
+    appendString (quoted, name.data (), name.size ());
+    quoted += "\"";
+    it = m_moduleNames.insert (std::make_pair (module, quoted)).first;
+  }
+  return it->second;
+}
+
+/**
+\brief Append text to a JSON string, with escapes where needed
+
+Text is assumed to be UTF-8 and copied as-is, except for quotes, backslashes and
+control characters.
+ */
+void ChromeTraceOutput::appendString (std::string &out, const char *text, size_t length)
+{
+  for (size_t i = 0; i < length; i++)
+  {
+    unsigned char c = text[i];
+    switch (c)
+    {
+      case '"':
+        out += "\\\"";
+        break;
+      case '\\':
+        out += "\\\\";
+        break;
+      case '\n':
+        out += "\\n";
+        break;
+      case '\r':
+        out += "\\r";
+        break;
+      case '\t':
+        out += "\\t";
+        break;
+      default:
+        if (c < 0x20)
+        {
+          char esc[8];
+          snprintf (esc, sizeof (esc), "\\u%04x", c);
+          out += esc;
+        }
+        else
+        {
+          out += (char)c;
+        }
+        break;
+    }
+  }
+}
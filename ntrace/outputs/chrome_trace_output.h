@@ -0,0 +1,69 @@
+#pragma once
+
+#include <fstream>
+#include <unordered_map>
+
+#include "../interfaces.h"
+#include "../output_base.h"
+
+namespace NTrace
+{
+
+
+/**
+\brief Output in the Chrome Trace Event Format
+
+Writes a JSON file that can be loaded in Perfetto (ui.perfetto.dev) or
+chrome://tracing, which show a timeline per thread:
+- Entry and Exit messages (TR_FUNC) become begin and end ("B"/"E") events, so
+  every traced call is a slice; the function arguments are added as an argument.
+- Other messages become instant events on their thread, with the level, module
+  and message type as arguments.
+- Thread names set with IManager::setThreadName() are written as metadata.
+
+The file is a JSON array that is written as the messages come in and flushed
+after every batch. The closing bracket is only written when the output is
+destroyed; the format allows it to be missing, so the file can also be loaded
+when the program was killed.
+
+Timestamps are the monotonic time in microseconds, with nanosecond decimals.
+
+getName() returns the fixed string "ntrace.chrome_trace_output".
+
+*/
+class ChromeTraceOutput : public OutputBase
+{
+public:
+  NTRACE_EXPORT ChromeTraceOutput (const std::string &filename);
+  ~ChromeTraceOutput ();
+
+  virtual void NTRACE_CALL saveMessage (const Message &msg);
+  virtual void NTRACE_CALL saveMessages (const Message *begin, const Message *end);
+
+private:
+  /// What we have written about a thread
+  struct ThreadState
+  {
+    std::string name;
+    unsigned long checked; ///< Batch in which the name was last looked up
+  };
+
+  void formatEvent (const Message &msg);
+  void checkThreadName (const Message &msg);
+  const std::string &moduleName (const IInput *module);
+  void beginEvent ();
+
+  static void appendString (std::string &out, const char *text, size_t length);
+
+  std::string m_filename;
+  std::ofstream m_outStream;
+  bool m_failed;       ///< The file could not be opened; don't try again for every batch
+  bool m_firstEvent;   ///< No event has been written yet, so no separator is needed
+  std::string m_buffer; ///< JSON of the current batch; keeps its capacity
+  unsigned long m_batch;
+
+  std::unordered_map<int, ThreadState> m_threads;
+  std::unordered_map<const IInput *, std::string> m_moduleNames; ///< Names as JSON strings
+};
+
+}
@@ -2,9 +2,7 @@
 #include <Windows.h>
 #endif
 
-#include <iomanip>
 #include <iostream>
-#include <sstream>
 
 #include "debug_output.h"
 
@@ -12,61 +10,31 @@
 using namespace NTrace;
 
 DebugOutput::DebugOutput (const Timestamp &start_time)
-  : OutputBase ("ntrace.debug_output", start_time)
+  : OutputBase ("ntrace.debug_output", start_time), m_layout ("(%pid) [%rel.ms] %indent%msg", start_time)
 {
-  m_indent = 0;
 }
 
+void DebugOutput::setLayout (const std::string &pattern)
+{
+  m_layout.compile (pattern);
+}
 
 void DebugOutput::saveMessage (const Message &msg)
 {
-  std::ostringstream buf;
-
-  // Log processs ID
-  buf << "(" << std::setw (5) << msg.pid << ") ";
-  // Timestamp (relative)
-  buf << "[" << std::setw (10) << std::fixed << std::setprecision (3) << msg.timestamp.getDifference (m_startTime) << "] ";
-
-  switch (msg.type)
-  {
-    case Message::Type::Normal:
-      buf << m_indentString;
-      break;
-
-    case Message::Type::Out:
-    case Message::Type::Error:
-      buf.clear (); // no prefix
-      break;
-
-    case Message::Type::Entry:
-      buf << m_indentString << ">> ";
-      m_indent++;
-      m_indentString.resize (2 * m_indent, ' ');
-      break;
-     case Message::Type::Exit:
-      if (m_indent > 0)
-      {
-        m_indent--;
-      }
-      m_indentString.resize (2 * m_indent, ' ');
-      buf << m_indentString << "<< ";
-      break;
-  }
-
-  // Finally add message
-  buf << msg.message;
+  m_line.clear ();
+  m_layout.format (msg, m_line);
 
   // Distinguish between error message and regular messages
   if (Message::Type::Error == msg.type)
   {
-    std::cerr << buf.str () << std::endl;
+    std::cerr << m_line << std::endl;
   }
   else
   {
-    std::cout << buf.str () << std::endl;
+    std::cout << m_line << std::endl;
   }
 #if defined(_WIN32)
-  buf << std::endl; // add newline
-  OutputDebugString (buf.str ().c_str ());
+  m_line += '\n';
+  OutputDebugString (m_line.c_str ());
 #endif
 }
@@ -2,6 +2,7 @@
 
 
 #include "../interfaces.h"
+#include "../layout.h"
 #include "../output_base.h"
 
 namespace NTrace
@@ -12,6 +13,7 @@ namespace NTrace
 \brief Output channel to write message to the default debug output
 
 Formats string nicely, with process id, relative time and indented function calls.
+The layout can be changed with setLayout(); the default is "(%pid) [%rel.ms] %indent%msg".
 
 getName() returns the fixed string "ntrace.debug_output".
 
@@ -25,19 +27,21 @@ public:
 
    The time in the output will be relative to the starting time.
    */
-  DebugOutput (const Timestamp &start_time);
+  NTRACE_EXPORT DebugOutput (const Timestamp &start_time);
 
   virtual void NTRACE_CALL saveMessage (const Message &msg);
 
-private:
   /**
-   \brief Current indentation level
-   For each NTrace::Entry message the indentation level is increased, and decreased
-   with every NTrace::Exit message. This should provide a nice graphical
-   view of the fuction flow.
+   \brief Set the layout of the lines
+   \param pattern The layout; see Layout for the fields
+
+   Must be called before the output is added to the manager.
    */
-  int m_indent; ///< Current indentation level
-  std::string m_indentString; ///< Pre-calculated indentation string
+  NTRACE_EXPORT void setLayout (const std::string &pattern);
+
+private:
+  Layout m_layout;
+  std::string m_line; ///< Text of the current message; keeps its capacity
 };
 
 }
\ No newline at end of file
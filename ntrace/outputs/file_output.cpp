@@ -3,13 +3,11 @@
 #include <Windows.h>
 #endif
 
-#include <iomanip>
-#include <iostream>
 #include <map>
-#include <sstream>
 #include <stdio.h>
 #include <string>
 #include <time.h>
+#include <vector>
 
 #if defined(__GNUC__)
 #include <dirent.h>
@@ -20,6 +18,8 @@
 #endif
 
 #include "file_output.h"
+#include "log_compressor.h"
+#include "uring_writer.h"
 
 using namespace NTrace;
 
@@ -33,6 +33,19 @@ static const int eof_len = 1;
 #error System not supported.
 #endif
 
+/**
+\brief Return true if a file or directory called \p name exists
+ */
+static bool fileExists (const std::string &name)
+{
+#if defined(_WIN32)
+  return INVALID_FILE_ATTRIBUTES != GetFileAttributes (name.c_str ());
+#else
+  struct stat file_stat;
+  return 0 == stat (name.c_str (), &file_stat);
+#endif
+}
+
 /**
 \brief FileOutput constructor
 \param basename Full path to the log file basename (without extension)
@@ -46,7 +59,9 @@ Sets up an Output module that writes to a text file; the output is formatted to
 
 The current log filename is always the \p basename and \p extension concatenated together; if you
 specify a \p max_file_size and the file reaches the limit, the file will be closed, renamed to
-basename-YYMMDD-HHMMSS.extension and a new file will be openend. If \p max_number_of_files
+basename-YYMMDD-HHMMSS.extension and a new file will be openend. When that name is
+taken, because the file rotated more than once within a second, a counter is added:
+basename-YYMMDD-HHMMSS-1.extension and so on. If \p max_number_of_files
 is also set, old files will be purged at that moment.
 
 Specifying \p max_number_of_files without a \p max_file_size is possible but pointless.
@@ -56,7 +71,7 @@ getName() returns the fixed string "ntrace.file_output".
 FileOutput::FileOutput (const std::string &basename, const std::string &extension, unsigned int max_file_size, int max_number_of_files, char file_separator)
   : OutputBase ("ntrace.file_output"),
   m_fileBasename (basename), m_fileExtension (extension), m_maximumFilesize (max_file_size), m_maximumNumberOfFiles (max_number_of_files),
-  m_fileSeparator (file_separator)
+  m_fileSeparator (file_separator), m_layout ("(%pid) [%utc.ms] %msg", Timestamp (0, 0))
 {
   // extract directory part of basename (including directory separator)
   size_t slash_pos = m_fileBasename.find_last_of (DIR_SEPARATOR);
@@ -71,110 +86,283 @@ FileOutput::FileOutput (const std::string &basename, const std::string &extensio
   m_dirBasename += DIR_SEPARATOR;
 
   m_currentFileSize = 0;
+  m_writer.reset (new StreamWriter);
+
+  m_maxBufferedBytes = 0;
+  m_maxDelay = std::chrono::milliseconds (0);
+  m_flushOnError = true;
+  m_sync = false;
 }
 
-void FileOutput::saveMessage (const Message &msg)
+/**
+\brief Destructor; writes what is still buffered
+ */
+FileOutput::~FileOutput ()
+{
+  flush ();
+  m_writer->close ();
+  // The compressor calls back into this object until its thread has ended
+  m_compressor.reset ();
+}
+
+/**
+\brief Select how the file is written
+\param mode Write mode
+\param size For MappedWrite: the amount by which the file is grown and mapped at a
+  time (64 MB by default). For UringWrite: the size of each of the 4 write buffers
+  (1 MB by default). 0 selects the default.
+\return false if the mode is not available on this system
+
+UringWrite is available when the library was built with a recent enough
+<linux/io_uring.h>; if the kernel then turns out not to support io_uring, the
+file is written with pwrite() instead.
+
+Must be called before the output is added to the manager.
+ */
+bool FileOutput::setWriteMode (WriteMode mode, size_t size)
 {
-  if (!m_outStream.is_open ())
+  if (m_writer->isOpen ())
   {
-    if (!openOutputStream ())
-    {
-      return;
-    }
+    flush ();
+    m_writer->close ();
+  }
+  switch (mode)
+  {
+    case StreamWrite:
+      m_writer.reset (new StreamWriter);
+      return true;
+    case MappedWrite:
+#if !defined(_WIN32)
+      m_writer.reset (new MappedWriter (size > 0 ? size : 64 * 1024 * 1024));
+      return true;
+#else
+      return false;
+#endif
+    case UringWrite:
+#if defined(HAVE_IO_URING)
+      m_writer.reset (new UringWriter (size > 0 ? size : 1024 * 1024, 4));
+      return true;
+#else
+      return false;
+#endif
   }
+  return false;
+}
 
-  // Format string
-  std::ostringstream buf;
-  const int timebuf_len = 25;
-  char timebuf[timebuf_len] = {'\0'};
-  struct tm *when = 0;
-  time_t st = 0;
+/**
+\brief Set when buffered text is written to the file
+\param max_buffered_bytes Write when this much text is waiting; 0 for no limit
+\param max_delay_ms Write when the oldest text has waited this long; 0 for no limit
+\param flush_on_error Write at once when a batch contains an error message
+\param sync After each write, wait until the data is on disk (fdatasync); with
+  UringWrite the sync is queued behind the write instead of waited for
+
+By default both limits are 0, which means that every batch is written as soon as
+it comes in. With limits, text is kept in memory until one of them is reached, so
+that several batches end up in a single write (and a single sync, if \p sync is
+set). The delay is checked when a batch comes in and, when no messages are
+coming in, every few milliseconds (see IOutput::idle()).
+
+Rotation is not affected: a file still ends at the message that reaches the
+maximum size. Text that is waiting when the output is destroyed is written then.
+ */
+void FileOutput::setFlushPolicy (size_t max_buffered_bytes, unsigned int max_delay_ms, bool flush_on_error, bool sync)
+{
+  m_maxBufferedBytes = max_buffered_bytes;
+  m_maxDelay = std::chrono::milliseconds (max_delay_ms);
+  m_flushOnError = flush_on_error;
+  m_sync = sync;
+}
 
-  // Log processs ID
-  buf << "(" << std::setw (5) << msg.pid << ") ";
+/**
+\brief Write all buffered text to the file
 
-  // Timestamp (absolute)
-  st = msg.timestamp.getTime ();
-  when = gmtime (&st);
-  if (nullptr == when)
+Must be called from the thread that delivers messages to this output, or when
+it is not in use by the manager.
+ */
+void FileOutput::flush ()
+{
+  if (m_writer->isOpen ())
   {
-    buf << "[??-??-?? ??:??:??.???] ";
+    writeBuffer ();
   }
-  else
+}
+
+/**
+\brief Set the layout of the lines in the file
+\param pattern The layout; see Layout for the fields
+
+Must be called before the output is added to the manager.
+ */
+void FileOutput::setLayout (const std::string &pattern)
+{
+  m_layout.compile (pattern);
+}
+
+/**
+\brief Compress files after they are rotated
+\param method Compression method
+\param level Compression level (1-9 for gzip, 1-19 for zstd); 0 for the default
+\return false if the library was built without support for \p method
+
+The files are compressed by a low priority thread, so rotation does not wait
+for it. When the output is destroyed, the files that are still waiting are
+compressed first.
+
+Must be called before the output is added to the manager.
+ */
+bool FileOutput::setCompression (Compression method, int level)
+{
+  LogCompressor::Method compressor_method = LogCompressor::Gzip;
+  switch (method)
   {
-    strftime (timebuf, timebuf_len, "%Y-%m-%d %H:%M:%S", when);
-    buf << "[" << timebuf << ".";
-    snprintf (timebuf, timebuf_len, "%03d", msg.timestamp.getMillis ());
-    buf << timebuf << "] ";
+    case NoCompression:
+      m_compressor.reset ();
+      return true;
+    case GzipCompression:
+      compressor_method = LogCompressor::Gzip;
+      break;
+    case ZstdCompression:
+      compressor_method = LogCompressor::Zstd;
+      break;
   }
+  if (!LogCompressor::isAvailable (compressor_method))
+  {
+    return false;
+  }
+  m_compressor.reset (new LogCompressor (compressor_method, level,
+    [this] (const std::string &filename) { compressionDone (filename); }));
+  return true;
+}
 
-  // Finish buffer
-  buf << msg.message;
-
-  // Update filesize (will be reset in rotateOutputStream)
-  m_currentFileSize += buf.str ().length ();
-  m_currentFileSize += eof_len;
-  if (m_maximumFilesize > 0 &&
-    m_currentFileSize > m_maximumFilesize)
+/**
+\brief Write buffered text that has waited longer than the maximum delay
+ */
+void FileOutput::idle ()
+{
+  if (!m_buffer.empty () && m_maxDelay.count () > 0 &&
+    std::chrono::steady_clock::now () - m_bufferedSince >= m_maxDelay)
   {
-    if (!rotateOutputStream ())
-    {
-      // Hmm, oops?
-      return;
-    }
+    flush ();
   }
+}
 
-  m_outStream << buf.str () << std::endl;
+void FileOutput::saveMessage (const Message &msg)
+{
+  saveMessages (&msg, &msg + 1);
 }
 
 /**
-  \brief Try to open the log file
-
+\brief Write a batch of messages
 
+The batch is formatted into a buffer, which is written at once unless the flush
+policy says it may wait for more batches. If the maximum file size is reached
+halfway, the part before that goes to the current file and the rest to the new one.
  */
-bool FileOutput::openOutputStream ()
+void FileOutput::saveMessages (const Message *begin, const Message *end)
 {
-  m_currentFilename = m_fileBasename + m_fileExtension;
+  if (!m_writer->isOpen ())
+  {
+    if (!openOutputStream ())
+    {
+      return;
+    }
+  }
 
-  // get file info, see if we need to rotate now.
-#if defined(_WIN32)
-  HANDLE hf = CreateFile (m_currentFilename.c_str (),
-    0, // no access required, just for size.
-    FILE_SHARE_READ,
-    NULL,
-    OPEN_EXISTING,
-    FILE_ATTRIBUTE_NORMAL,
-    NULL);
-  if (INVALID_HANDLE_VALUE == hf)
+  if (m_buffer.empty ())
   {
-    // Does not exist, ok
-    m_currentFileSize = 0;
+    m_bufferedSince = std::chrono::steady_clock::now ();
   }
-  else
+  bool urgent = false;
+  for (const Message *msg = begin; msg != end; ++msg)
   {
-    LARGE_INTEGER large;
-    GetFileSizeEx (hf, &large);
-    m_currentFileSize = large.LowPart;
-    CloseHandle (hf);
+    size_t start = m_buffer.size ();
+    formatMessage (*msg, m_buffer);
+    if (Message::Error == msg->type && m_flushOnError)
+    {
+      urgent = true;
+    }
+
+    // Update filesize (will be reset in rotateOutputStream); the newline may take more than 1 byte
+    unsigned long line_size = (unsigned long)(m_buffer.size () - start - 1 + eof_len);
+    m_currentFileSize += line_size;
+    if (m_maximumFilesize > 0 &&
+      m_currentFileSize > m_maximumFilesize)
+    {
+      // Everything before this message still goes in the current file
+      m_writer->write (m_buffer.data (), start);
+      if (m_sync)
+      {
+        m_writer->sync ();
+      }
+      m_buffer.erase (0, start);
+      m_bufferedSince = std::chrono::steady_clock::now ();
+      if (!rotateOutputStream ())
+      {
+        // Hmm, oops?
+        return;
+      }
+      m_currentFileSize += line_size;
+    }
   }
-#elif defined(__GNUC__)
-  // use POSIX stat
 
-  struct stat file_stat;
-  if (stat (m_currentFilename.c_str (), &file_stat) < 0)
+  if (urgent ||
+    (0 == m_maxBufferedBytes && 0 == m_maxDelay.count ()) ||
+    (m_maxBufferedBytes > 0 && m_buffer.size () >= m_maxBufferedBytes) ||
+    (m_maxDelay.count () > 0 && std::chrono::steady_clock::now () - m_bufferedSince >= m_maxDelay))
+  {
+    writeBuffer ();
+  }
+}
+
+/**
+\brief Write the buffer to the file and empty it
+ */
+void FileOutput::writeBuffer ()
+{
+  if (m_buffer.empty ())
   {
-    // does not exist
-    m_currentFileSize = 0;
+    return;
+  }
+  m_writer->write (m_buffer.data (), m_buffer.size ());
+  if (m_sync)
+  {
+    m_writer->sync ();
   }
   else
   {
-    m_currentFileSize = file_stat.st_size;
+    m_writer->flush ();
   }
+  m_buffer.clear ();
+}
+
+/**
+\brief Format a single message as a line of text
+\param msg The message
+\param out String to append the line to, including the newline
+ */
+void FileOutput::formatMessage (const Message &msg, std::string &out)
+{
+  m_layout.format (msg, out);
+  out += '\n';
+}
+
+/**
+  \brief Try to open the log file
 
-#endif
 
-  m_outStream.open (m_currentFilename, std::ios_base::out | std::ios_base::app | std::ios_base::ate);
-  return m_outStream.is_open ();
+ */
+bool FileOutput::openOutputStream ()
+{
+  m_currentFilename = m_fileBasename + m_fileExtension;
+
+  // The size of an existing file counts towards the limit, so we may need to rotate soon
+  if (!m_writer->open (m_currentFilename))
+  {
+    return false;
+  }
+  m_currentFileSize = (unsigned long)m_writer->getSize ();
+  return true;
 }
 
 /**
@@ -189,10 +377,7 @@ bool FileOutput::rotateOutputStream ()
   const int namebuf_len = 20;
   char namebuf[namebuf_len];
 
-  if (m_outStream.is_open ())
-  {
-    m_outStream.close ();
-  }
+  m_writer->close ();
 
   time_t now;
   struct tm *now_tm;
@@ -209,11 +394,31 @@ bool FileOutput::rotateOutputStream ()
   new_name += m_fileSeparator;
   new_name += namebuf;
   new_name += m_fileExtension;
+  // The name has a resolution of one second; don't overwrite a file of the same
+  // second, nor one that the compressor still has to handle
+  for (unsigned int counter = 1; rotatedNameTaken (new_name); counter++)
+  {
+    new_name = m_fileBasename;
+    new_name += m_fileSeparator;
+    new_name += namebuf;
+    new_name += m_fileSeparator;
+    new_name += std::to_string (counter);
+    new_name += m_fileExtension;
+  }
 
   if (rename (m_currentFilename.c_str (), new_name.c_str ()))
   {
     return false;
   }
+  if (m_compressor)
+  {
+    std::string pending_name = getPurgeName (new_name);
+    {
+      std::lock_guard<std::mutex> lock (m_purgeMutex);
+      m_compressingFiles.insert (pending_name);
+    }
+    m_compressor->add (pending_name);
+  }
 
   if (m_maximumNumberOfFiles > 0)
   {
@@ -222,44 +427,89 @@ bool FileOutput::rotateOutputStream ()
   return openOutputStream ();
 }
 
+/**
+\brief Return true if \p name, or the compressed version of it, is in use
+ */
+bool FileOutput::rotatedNameTaken (const std::string &name)
+{
+  if (fileExists (name) ||
+    fileExists (name + LogCompressor::getSuffix (LogCompressor::Gzip)) ||
+    fileExists (name + LogCompressor::getSuffix (LogCompressor::Zstd)))
+  {
+    return true;
+  }
+  std::lock_guard<std::mutex> lock (m_purgeMutex);
+  return 0 != m_compressingFiles.count (getPurgeName (name));
+}
+
+/**
+\brief Called on the compressor thread when it is done with a rotated file
+ */
+void FileOutput::compressionDone (const std::string &filename)
+{
+  {
+    std::lock_guard<std::mutex> lock (m_purgeMutex);
+    m_compressingFiles.erase (filename);
+  }
+  if (m_maximumNumberOfFiles > 0)
+  {
+    checkAndPurgeLogfiles ();
+  }
+}
+
 /**
 \brief Check for logfiles based on the basename and remove older ones
 
-Note: files are removed based on age, not on name.
+Compressed files count as well; files that the compressor still has to handle
+are skipped. Note: files are removed based on age, not on name.
  */
 void FileOutput::checkAndPurgeLogfiles ()
 {
-  // Mapping from ftimestamp to filename; this automatically orders the entries.
-  std::map<time_t, std::string> m_fileTimes;
-  std::string pattern;
+  std::lock_guard<std::mutex> lock (m_purgeMutex);
+  // The file that is being written matches the pattern as well; the compressor
+  // purges while it exists, rotation while it is renamed
+  std::string current_name = getPurgeName (m_fileBasename + m_fileExtension);
+
+  // Mapping from timestamp to filename; this automatically orders the entries.
+  std::multimap<time_t, std::string> m_fileTimes;
+  std::vector<std::string> patterns;
 
-  // Our pattern to match
-  pattern = m_fileBasename + "*" + m_fileExtension;
+  // Our patterns to match
+  patterns.push_back (m_fileBasename + "*" + m_fileExtension);
+  patterns.push_back (m_fileBasename + "*" + m_fileExtension + LogCompressor::getSuffix (LogCompressor::Gzip));
+  patterns.push_back (m_fileBasename + "*" + m_fileExtension + LogCompressor::getSuffix (LogCompressor::Zstd));
 
 #if defined(_WIN32)
   HANDLE find;
   WIN32_FIND_DATA data;
   ULARGE_INTEGER ui;
 
-  find = FindFirstFile (pattern.c_str (), &data);
-  if (INVALID_HANDLE_VALUE == find)
+  for (std::vector<std::string>::iterator pattern = patterns.begin (); pattern != patterns.end (); ++pattern)
   {
-    return;
-  }
+    find = FindFirstFile (pattern->c_str (), &data);
+    if (INVALID_HANDLE_VALUE == find)
+    {
+      continue;
+    }
 
-  do
-  {
-    // store timestamp with filename. Convert FILETIME to time_t-ish
-    ui.LowPart = data.ftCreationTime.dwLowDateTime;
-    ui.HighPart = data.ftCreationTime.dwHighDateTime;
-    // Divide by 10^7 to go from 100ns to seconds
-    uint64_t us = ui.QuadPart / 10000000ULL;
-    // Subtract epoch to reach Jan 1, 1970. 
-    us -= 11644473600ULL;
-    // cFileName is only the filename part, not the full path.
-    m_fileTimes[us] = data.cFileName;
-  } while (FindNextFile (find, &data));
-  FindClose (find);
+    do
+    {
+      // store timestamp with filename. Convert FILETIME to time_t-ish
+      ui.LowPart = data.ftCreationTime.dwLowDateTime;
+      ui.HighPart = data.ftCreationTime.dwHighDateTime;
+      // Divide by 10^7 to go from 100ns to seconds
+      uint64_t us = ui.QuadPart / 10000000ULL;
+      // Subtract epoch to reach Jan 1, 1970. 
+      us -= 11644473600ULL;
+      // cFileName is only the filename part, not the full path.
+      if (m_compressingFiles.count (m_dirBasename + data.cFileName) || current_name == m_dirBasename + data.cFileName)
+      {
+        continue;
+      }
+      m_fileTimes.insert (std::make_pair ((time_t)us, std::string (data.cFileName)));
+    } while (FindNextFile (find, &data));
+    FindClose (find);
+  }
 
 #elif defined (__GNUC__)
   DIR *scan_dir = 0;
@@ -276,12 +526,16 @@ void FileOutput::checkAndPurgeLogfiles ()
   while (NULL != dir_entry)
   {
     std::string t = m_dirBasename + dir_entry->d_name;
-    if (0 == fnmatch (pattern.c_str (), t.c_str (), FNM_FILE_NAME))
+    for (std::vector<std::string>::iterator pattern = patterns.begin (); pattern != patterns.end (); ++pattern)
     {
-      if (0 == stat (t.c_str (), &file_stat))
+      if (0 == fnmatch (pattern->c_str (), t.c_str (), FNM_FILE_NAME))
       {
-        // use creation time for mapping
-        m_fileTimes[file_stat.st_ctime] = dir_entry->d_name;
+        if (0 == m_compressingFiles.count (t) && current_name != t && 0 == stat (t.c_str (), &file_stat))
+        {
+          // use modification time for mapping; a compressed file keeps the time of the original
+          m_fileTimes.insert (std::make_pair (file_stat.st_mtime, std::string (dir_entry->d_name)));
+        }
+        break;
       }
     }
     // Read next entry
@@ -291,7 +545,7 @@ void FileOutput::checkAndPurgeLogfiles ()
 #endif
 
   // Files should be stored sorted, accoring to the key (time_t)
-  std::map<time_t, std::string>::iterator it = m_fileTimes.begin ();
+  std::multimap<time_t, std::string>::iterator it = m_fileTimes.begin ();
   while (m_fileTimes.size () > m_maximumNumberOfFiles)
   {
     remove ((m_dirBasename + it->second).c_str ());
@@ -299,4 +553,11 @@ void FileOutput::checkAndPurgeLogfiles ()
   }
 }
 
-
+/**
+\brief Return \p filename the way checkAndPurgeLogfiles() builds it: m_dirBasename followed by the file name
+ */
+std::string FileOutput::getPurgeName (const std::string &filename) const
+{
+  // npos + 1 is 0, so a name without directory is taken as a whole
+  return m_dirBasename + filename.substr (filename.find_last_of (DIR_SEPARATOR) + 1);
+}
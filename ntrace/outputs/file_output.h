@@ -1,13 +1,19 @@
 #pragma once
 
-#include <fstream>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <set>
 
 #include "../interfaces.h"
+#include "../layout.h"
 #include "../output_base.h"
+#include "file_writer.h"
 
 namespace NTrace
 {
 
+class LogCompressor;
 
 /**
 \brief Log output to a file
@@ -15,16 +21,57 @@ namespace NTrace
 Includes options for maximum file length, automatic recycling of log files, etc.
 
 By default FileOutput writes endlessly to a single log file; however, when you enable
-a maximum size or log file rotation, a timestamp gets appended to the filename (of the form YYMMDD-HHMMSS).
+a maximum size or log file rotation, a timestamp gets appended to the filename (of the form YYMMDD-HHMMSS, with a counter
+after it when the file rotates more than once in a second).
 In addition you can restrict the number of log files; old logfiles are automatically removed.
 
+By default the file is written through a stream, with one write per batch of
+messages. setWriteMode() selects a memory-mapped file (see MappedWriter) or
+asynchronous writes through io_uring (see UringWriter) instead.
+setFlushPolicy() lets the text of several batches collect before it is written,
+and can make each write wait until the data is on disk.
+
+Each message is a line in the form set by setLayout(); the default is
+"(%pid) [%utc.ms] %msg".
+
+With setCompression(), rotated files are compressed in the background; the
+maximum number of files then also counts the compressed ones. Files that are
+waiting for the compressor are left alone by the purge; it runs again when the
+compressor is done with each file.
+
 */
 class FileOutput : public OutputBase
 {
 public:
   NTRACE_EXPORT FileOutput (const std::string &basename, const std::string &extension, unsigned int max_file_size = 0, int max_number_of_files = 0, char file_separator = '-');
+  NTRACE_EXPORT ~FileOutput ();
 
   virtual void NTRACE_CALL saveMessage (const Message &msg);
+  virtual void NTRACE_CALL saveMessages (const Message *begin, const Message *end);
+  virtual void NTRACE_CALL idle ();
+
+  /// How the file is written
+  enum WriteMode
+  {
+    StreamWrite, ///< Through a stdio stream (default)
+    MappedWrite, ///< By copying into a memory mapping of the file; not available on Windows
+    UringWrite   ///< With asynchronous writes through io_uring; Linux only
+  };
+
+  NTRACE_EXPORT bool setWriteMode (WriteMode mode, size_t size = 0);
+  NTRACE_EXPORT void setFlushPolicy (size_t max_buffered_bytes, unsigned int max_delay_ms, bool flush_on_error = true, bool sync = false);
+  NTRACE_EXPORT void flush ();
+  NTRACE_EXPORT void setLayout (const std::string &pattern);
+
+  /// How rotated files are compressed
+  enum Compression
+  {
+    NoCompression,   ///< Leave them as they are (default)
+    GzipCompression, ///< gzip, with zlib; adds ".gz"
+    ZstdCompression  ///< zstd, with libzstd; adds ".zst"
+  };
+
+  NTRACE_EXPORT bool setCompression (Compression method, int level = 0);
 
 private:
   std::string m_dirBasename;
@@ -35,13 +82,30 @@ private:
   unsigned int m_maximumFilesize;
   unsigned int m_maximumNumberOfFiles;
 
-  std::ofstream m_outStream;
+  std::unique_ptr<FileWriter> m_writer;
+  std::mutex m_purgeMutex;                  ///< Rotation and the compressor both purge
+  std::set<std::string> m_compressingFiles; ///< Handed to the compressor and not done yet
+  std::unique_ptr<LogCompressor> m_compressor;
   std::string m_currentFilename;
   unsigned long m_currentFileSize;
+  std::string m_buffer; ///< Text that has not been written yet; keeps its capacity
+  Layout m_layout;
+
+  size_t m_maxBufferedBytes;
+  std::chrono::milliseconds m_maxDelay;
+  bool m_flushOnError;
+  bool m_sync;
+  std::chrono::steady_clock::time_point m_bufferedSince; ///< When the oldest text in m_buffer was added
+
+  void formatMessage (const Message &msg, std::string &out);
+  void writeBuffer ();
 
   bool openOutputStream ();
   bool rotateOutputStream ();
+  bool rotatedNameTaken (const std::string &name);
   void checkAndPurgeLogfiles ();
+  std::string getPurgeName (const std::string &filename) const;
+  void compressionDone (const std::string &filename);
 };
 
 }
@@ -0,0 +1,296 @@
+#if defined(_WIN32)
+#define _CRT_SECURE_NO_WARNINGS
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <string.h>
+
+#include <vector>
+
+#include "file_writer.h"
+
+using namespace NTrace;
+
+StreamWriter::StreamWriter ()
+  : m_file (nullptr), m_size (0)
+{
+}
+
+StreamWriter::~StreamWriter ()
+{
+  close ();
+}
+
+bool StreamWriter::open (const std::string &filename)
+{
+  close ();
+  m_file = fopen (filename.c_str (), "a");
+  if (nullptr == m_file)
+  {
+    return false;
+  }
+  // "a" does not move to the end until the first write
+  fseek (m_file, 0, SEEK_END);
+  long pos = ftell (m_file);
+  m_size = pos > 0 ? (uint64_t)pos : 0;
+  return true;
+}
+
+bool StreamWriter::isOpen () const
+{
+  return nullptr != m_file;
+}
+
+bool StreamWriter::write (const char *data, size_t length)
+{
+  size_t written = fwrite (data, 1, length, m_file);
+  m_size += written;
+  return written == length;
+}
+
+void StreamWriter::flush ()
+{
+  fflush (m_file);
+}
+
+bool StreamWriter::sync ()
+{
+  if (0 != fflush (m_file))
+  {
+    return false;
+  }
+#if defined(_WIN32)
+  return 0 == _commit (_fileno (m_file));
+#elif defined(__APPLE__)
+  return 0 == fsync (fileno (m_file));
+#else
+  return 0 == fdatasync (fileno (m_file));
+#endif
+}
+
+void StreamWriter::close ()
+{
+  if (m_file)
+  {
+    fclose (m_file);
+    m_file = nullptr;
+  }
+}
+
+uint64_t StreamWriter::getSize () const
+{
+  return m_size;
+}
+
+#if !defined(_WIN32)
+
+/**
+  \brief Constructor
+  \param segment_size Size by which the file grows; rounded up to whole pages
+ */
+MappedWriter::MappedWriter (size_t segment_size)
+  : m_fd (-1), m_size (0), m_map (nullptr), m_mapStart (0), m_mapEnd (0), m_synced (0)
+{
+  size_t page = (size_t)sysconf (_SC_PAGESIZE);
+  if (segment_size < page)
+  {
+    segment_size = page;
+  }
+  m_segmentSize = (segment_size + page - 1) / page * page;
+}
+
+MappedWriter::~MappedWriter ()
+{
+  close ();
+}
+
+bool MappedWriter::open (const std::string &filename)
+{
+  close ();
+  m_fd = ::open (filename.c_str (), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (m_fd < 0)
+  {
+    return false;
+  }
+  struct stat file_stat;
+  if (fstat (m_fd, &file_stat) < 0)
+  {
+    close ();
+    return false;
+  }
+  m_size = findEnd (file_stat.st_size);
+  m_synced = m_size;
+  if (m_size != (uint64_t)file_stat.st_size && ftruncate (m_fd, m_size) < 0)
+  {
+    close ();
+    return false;
+  }
+  return true;
+}
+
+bool MappedWriter::isOpen () const
+{
+  return m_fd >= 0;
+}
+
+bool MappedWriter::write (const char *data, size_t length)
+{
+  while (length > 0)
+  {
+    if (nullptr == m_map || m_size >= m_mapEnd)
+    {
+      if (!mapSegment ())
+      {
+        return false;
+      }
+    }
+    size_t room = (size_t)(m_mapEnd - m_size);
+    size_t part = length < room ? length : room;
+    memcpy (m_map + (m_size - m_mapStart), data, part);
+    m_size += part;
+    data += part;
+    length -= part;
+  }
+  return true;
+}
+
+/**
+  \brief Nothing to do: the data is in the page cache as soon as it is copied
+ */
+void MappedWriter::flush ()
+{
+}
+
+/**
+  \brief Write the dirty part of the mapping to disk
+
+  Segments that have already been unmapped are taken care of by fdatasync(), which
+  also writes the allocation of the current segment.
+ */
+bool MappedWriter::sync ()
+{
+  if (m_map && m_size > m_mapStart)
+  {
+    size_t page = (size_t)sysconf (_SC_PAGESIZE);
+    uint64_t from = m_synced > m_mapStart ? m_synced / page * page : m_mapStart;
+    if (msync (m_map + (from - m_mapStart), (size_t)(m_size - from), MS_SYNC) < 0)
+    {
+      return false;
+    }
+  }
+#if defined(__APPLE__)
+  if (fsync (m_fd) < 0)
+#else
+  if (fdatasync (m_fd) < 0)
+#endif
+  {
+    return false;
+  }
+  m_synced = m_size;
+  return true;
+}
+
+/**
+  \brief Unmap the file and cut off the part that was allocated but not used
+ */
+void MappedWriter::close ()
+{
+  if (m_fd < 0)
+  {
+    return;
+  }
+  unmapSegment ();
+  if (ftruncate (m_fd, m_size) < 0)
+  {
+    // Nothing we can do; the next open() removes the zero bytes
+  }
+  ::close (m_fd);
+  m_fd = -1;
+  m_size = 0;
+  m_synced = 0;
+}
+
+uint64_t MappedWriter::getSize () const
+{
+  return m_size;
+}
+
+/**
+  \brief Allocate and map the segment that starts at the current end of the data
+
+  Mappings must start at a page boundary, so the new segment starts at the page
+  that contains the end of the data.
+ */
+bool MappedWriter::mapSegment ()
+{
+  unmapSegment ();
+  size_t page = (size_t)sysconf (_SC_PAGESIZE);
+  uint64_t start = m_size / page * page;
+
+  if (posix_fallocate (m_fd, start, m_segmentSize) != 0)
+  {
+    return false;
+  }
+  void *map = mmap (nullptr, m_segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, start);
+  if (MAP_FAILED == map)
+  {
+    return false;
+  }
+  m_map = (char *)map;
+  m_mapStart = start;
+  m_mapEnd = start + m_segmentSize;
+  return true;
+}
+
+void MappedWriter::unmapSegment ()
+{
+  if (m_map)
+  {
+    munmap (m_map, m_segmentSize);
+    m_map = nullptr;
+  }
+}
+
+/**
+  \brief Return the size of the data in a file that may end in unused, zeroed space
+  \param file_size Size of the file on disk
+
+  Only a file whose size is a whole number of pages can have been left behind by
+  a MappedWriter that did not close it; otherwise the file is used as is.
+ */
+uint64_t MappedWriter::findEnd (uint64_t file_size)
+{
+  size_t page = (size_t)sysconf (_SC_PAGESIZE);
+  if (0 == file_size || file_size % page != 0)
+  {
+    return file_size;
+  }
+
+  std::vector<char> buf (page);
+  uint64_t end = file_size;
+  while (end > 0)
+  {
+    if (pread (m_fd, &buf[0], page, end - page) != (ssize_t)page)
+    {
+      return file_size;
+    }
+    size_t used = page;
+    while (used > 0 && 0 == buf[used - 1])
+    {
+      used--;
+    }
+    if (used > 0)
+    {
+      return end - page + used;
+    }
+    end -= page;
+  }
+  return 0;
+}
+
+#endif
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <stdio.h>
+#include <string>
+
+namespace NTrace
+{
+
+/**
+  \brief Backend through which FileOutput writes its file
+
+  A writer appends to one file at a time. It keeps track of the size of the
+  file, counting from the size the file already had when it was opened.
+*/
+class FileWriter
+{
+public:
+  virtual ~FileWriter () {}
+
+  /**
+   \brief Open a file for appending; creates it if it does not exist
+   */
+  virtual bool open (const std::string &filename) = 0;
+  virtual bool isOpen () const = 0;
+  virtual bool write (const char *data, size_t length) = 0;
+  /// Hand everything written so far to the operating system
+  virtual void flush () = 0;
+  /// Flush, then wait until the data is on disk; UringWriter only starts the sync
+  virtual bool sync () = 0;
+  virtual void close () = 0;
+
+  /// Size of the file in bytes, including what has been written
+  virtual uint64_t getSize () const = 0;
+};
+
+/**
+  \brief Writer that uses a stdio stream
+
+  Every flush() results in a write(2) of what has been written since the last one.
+*/
+class StreamWriter : public FileWriter
+{
+public:
+  StreamWriter ();
+  ~StreamWriter ();
+
+  virtual bool open (const std::string &filename);
+  virtual bool isOpen () const;
+  virtual bool write (const char *data, size_t length);
+  virtual void flush ();
+  virtual bool sync ();
+  virtual void close ();
+  virtual uint64_t getSize () const;
+
+private:
+  FILE *m_file;
+  uint64_t m_size;
+};
+
+#if !defined(_WIN32)
+
+/**
+  \brief Writer that copies into a memory mapping of the file
+
+  The file is grown in segments (64 MB by default): each segment is allocated on
+  disk with posix_fallocate() and mapped, and writing is a memcpy() into the
+  mapping. No system call is made until the segment is full, and since the data
+  is in the page cache as soon as it is copied, it survives a crash of the
+  process (not of the system).
+
+  While the file is open it is as large as the allocated segments; the unused part
+  is filled with zero bytes. close() truncates the file to the exact size. When
+  a file is opened that still ends in zero bytes (because the process was killed
+  before it could close it), those are removed first.
+*/
+class MappedWriter : public FileWriter
+{
+public:
+  explicit MappedWriter (size_t segment_size);
+  ~MappedWriter ();
+
+  virtual bool open (const std::string &filename);
+  virtual bool isOpen () const;
+  virtual bool write (const char *data, size_t length);
+  virtual void flush ();
+  virtual bool sync ();
+  virtual void close ();
+  virtual uint64_t getSize () const;
+
+private:
+  bool mapSegment ();
+  void unmapSegment ();
+  uint64_t findEnd (uint64_t file_size);
+
+  size_t m_segmentSize;
+  int m_fd;
+  uint64_t m_size;      ///< Bytes of real data in the file
+  char *m_map;          ///< Current mapping; null if none
+  uint64_t m_mapStart;  ///< File offset of the mapping
+  uint64_t m_mapEnd;    ///< File offset of the end of the mapping
+  uint64_t m_synced;    ///< Data up to here is on disk
+};
+
+#endif
+
+} // namespace
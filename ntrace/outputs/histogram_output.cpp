@@ -0,0 +1,161 @@
+#include <algorithm>
+#include <stdio.h>
+
+#include "histogram_output.h"
+
+
+using namespace NTrace;
+
+/**
+\brief HistogramOutput constructor
+\param report Stream for the periodic report; may be null
+\param report_interval Seconds between reports; 0 to only report from the destructor
+
+The report is written with the timestamps of the messages as the clock, so
+nothing is written while the program is not logging. The stream must outlive
+the output.
+ */
+HistogramOutput::HistogramOutput (std::ostream *report, unsigned int report_interval)
+  : OutputBase ("ntrace.histogram_output"), m_report (report),
+    m_reportInterval (static_cast<int64_t> (report_interval) * 1000000000), m_haveReported (false)
+{
+}
+
+HistogramOutput::~HistogramOutput ()
+{
+  if (m_report)
+  {
+    dump (*m_report);
+  }
+}
+
+void HistogramOutput::saveMessage (const Message &msg)
+{
+  bool report = false;
+  {
+    std::lock_guard<std::mutex> lock (m_mutex);
+    if (Message::Entry == msg.type && msg.functionId != 0)
+    {
+      std::vector<Frame> &stack = m_stacks[msg.tid];
+      if (stack.size () >= s_maxDepth)
+      {
+        stack.erase (stack.begin ());
+      }
+      Frame frame = { msg.functionId, msg.timestamp };
+      stack.push_back (frame);
+    }
+    else if (Message::Exit == msg.type && msg.functionId != 0)
+    {
+      recordExit (msg);
+    }
+
+    if (m_report && m_reportInterval > 0)
+    {
+      if (!m_haveReported)
+      {
+        m_lastReport = msg.timestamp;
+        m_haveReported = true;
+      }
+      else if (msg.timestamp - m_lastReport >= m_reportInterval)
+      {
+        m_lastReport = msg.timestamp;
+        report = true;
+      }
+    }
+  }
+
+  if (report)
+  {
+    dump (*m_report);
+  }
+}
+
+/**
+\brief Find the Entry that belongs to an Exit and record the duration
+
+Must be called with m_mutex locked. Calls above the matching Entry lost their
+Exit and are discarded; an Exit without an Entry is ignored.
+ */
+void HistogramOutput::recordExit (const Message &msg)
+{
+  std::unordered_map<int, std::vector<Frame>>::iterator it = m_stacks.find (msg.tid);
+  if (it == m_stacks.end ())
+  {
+    return;
+  }
+  std::vector<Frame> &stack = it->second;
+  for (size_t i = stack.size (); i > 0; i--)
+  {
+    if (stack[i - 1].functionId == msg.functionId)
+    {
+      int64_t duration = msg.timestamp - stack[i - 1].entry;
+      m_histograms[msg.functionId].record (duration > 0 ? duration : 0);
+      stack.resize (i - 1);
+      break;
+    }
+  }
+  if (stack.empty ())
+  {
+    m_stacks.erase (it);
+  }
+}
+
+/**
+\brief Return the statistics of all functions that have been called
+
+Sorted by function name.
+ */
+std::vector<HistogramOutput::FunctionStatistics> HistogramOutput::getStatistics () const
+{
+  std::vector<FunctionStatistics> ret;
+  {
+    std::lock_guard<std::mutex> lock (m_mutex);
+    ret.reserve (m_histograms.size ());
+    for (std::unordered_map<uint32_t, LatencyHistogram>::const_iterator it = m_histograms.begin (); it != m_histograms.end (); ++it)
+    {
+      const LatencyHistogram &h = it->second;
+      FunctionStatistics stats;
+      const char *name = IManager::getFunctionName (it->first);
+      stats.function = name ? name : "?";
+      stats.count = h.getCount ();
+      stats.p50 = h.getPercentile (50.0);
+      stats.p99 = h.getPercentile (99.0);
+      stats.p999 = h.getPercentile (99.9);
+      stats.max = h.getMax ();
+      ret.push_back (stats);
+    }
+  }
+  std::sort (ret.begin (), ret.end (), [] (const FunctionStatistics &a, const FunctionStatistics &b) { return a.function < b.function; });
+  return ret;
+}
+
+/**
+\brief Write the statistics as a table, with durations in microseconds
+\param out Stream to write to
+ */
+void HistogramOutput::dump (std::ostream &out) const
+{
+  std::vector<FunctionStatistics> stats = getStatistics ();
+  char line[200];
+
+  snprintf (line, sizeof (line), "%-40s %10s %12s %12s %12s %12s\n", "function", "count", "p50 (us)", "p99 (us)", "p99.9 (us)", "max (us)");
+  out << line;
+  for (std::vector<FunctionStatistics>::const_iterator it = stats.begin (); it != stats.end (); ++it)
+  {
+    snprintf (line, sizeof (line), "%-40s %10llu %12.3f %12.3f %12.3f %12.3f\n", it->function.c_str (),
+      static_cast<unsigned long long> (it->count), it->p50 / 1000.0, it->p99 / 1000.0, it->p999 / 1000.0, it->max / 1000.0);
+    out << line;
+  }
+  out.flush ();
+}
+
+/**
+\brief Forget all durations
+
+Calls that are in progress are still measured when they end.
+ */
+void HistogramOutput::reset ()
+{
+  std::lock_guard<std::mutex> lock (m_mutex);
+  m_histograms.clear ();
+}
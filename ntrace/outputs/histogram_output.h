@@ -0,0 +1,77 @@
+#pragma once
+
+#include <mutex>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+#include "../interfaces.h"
+#include "../latency_histogram.h"
+#include "../output_base.h"
+
+namespace NTrace
+{
+
+
+/**
+\brief Output that measures how long functions take
+
+Pairs the Entry and Exit messages of every thread (as generated by TR_FUNC) and
+records the time between them in a LatencyHistogram per function. Nothing is
+written per message; instead a table with the count, median, 99th, 99.9th
+percentile and maximum of every function is written to a stream every
+\p report_interval seconds, and can be requested with dump() or getStatistics().
+
+When messages are dropped an Entry may lose its Exit or the other way around;
+such calls are left out rather than counted with a wrong duration.
+
+getName() returns the fixed string "ntrace.histogram_output".
+
+*/
+class HistogramOutput : public OutputBase
+{
+public:
+  /// Durations of one function, in nanoseconds
+  struct FunctionStatistics
+  {
+    std::string function;
+    uint64_t count;
+    uint64_t p50;
+    uint64_t p99;
+    uint64_t p999;
+    uint64_t max;
+  };
+
+  NTRACE_EXPORT HistogramOutput (std::ostream *report = nullptr, unsigned int report_interval = 0);
+  ~HistogramOutput ();
+
+  virtual void NTRACE_CALL saveMessage (const Message &msg);
+
+  NTRACE_EXPORT std::vector<FunctionStatistics> getStatistics () const;
+  NTRACE_EXPORT void dump (std::ostream &out) const;
+  NTRACE_EXPORT void reset ();
+
+private:
+  /// A function that has been entered but not yet left
+  struct Frame
+  {
+    uint32_t functionId;
+    Timestamp entry;
+  };
+
+  /// Maximum call depth kept per thread; protects against Exits that were dropped
+  static const size_t s_maxDepth = 256;
+
+  void recordExit (const Message &msg);
+
+  mutable std::mutex m_mutex;
+  std::unordered_map<int, std::vector<Frame>> m_stacks; ///< Open calls per thread ID
+  std::unordered_map<uint32_t, LatencyHistogram> m_histograms; ///< Per function ID
+
+  std::ostream *m_report;
+  int64_t m_reportInterval; ///< In nanoseconds; 0 if there is no periodic report
+  Timestamp m_lastReport;
+  bool m_haveReported; ///< m_lastReport has been set
+};
+
+}
@@ -0,0 +1,275 @@
+#if defined(_WIN32)
+#define _CRT_SECURE_NO_WARNINGS
+#include <Windows.h>
+#else
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+#include <stdio.h>
+
+#include <vector>
+
+#if defined(HAVE_ZLIB)
+#include <zlib.h>
+#endif
+#if defined(HAVE_ZSTD)
+#include <zstd.h>
+#endif
+
+#include "log_compressor.h"
+
+using namespace NTrace;
+
+/// Amount of the log file that is read at a time
+static const size_t s_chunkSize = 256 * 1024;
+
+/**
+  \brief Constructor; starts the thread
+  \param method Compression method; must be available (see isAvailable())
+  \param level Compression level; 0 for the default of the method
+  \param done Called on the compression thread after each file; may be empty
+ */
+LogCompressor::LogCompressor (Method method, int level, const DoneHandler &done)
+  : m_method (method), m_level (level), m_done (done), m_stopping (false)
+{
+  m_thread = std::thread (&LogCompressor::run, this);
+}
+
+/**
+  \brief Destructor; compresses the files that are still waiting, then ends the thread
+ */
+LogCompressor::~LogCompressor ()
+{
+  {
+    std::lock_guard<std::mutex> lock (m_mutex);
+    m_stopping = true;
+  }
+  m_available.notify_one ();
+  m_thread.join ();
+}
+
+/**
+  \brief Queue a file for compression
+  \param filename The rotated log file; nobody should write to it anymore
+ */
+void LogCompressor::add (const std::string &filename)
+{
+  {
+    std::lock_guard<std::mutex> lock (m_mutex);
+    m_files.push_back (filename);
+  }
+  m_available.notify_one ();
+}
+
+/**
+  \brief Return true if the library was built with support for \p method
+ */
+bool LogCompressor::isAvailable (Method method)
+{
+  switch (method)
+  {
+    case Gzip:
+#if defined(HAVE_ZLIB)
+      return true;
+#else
+      return false;
+#endif
+    case Zstd:
+#if defined(HAVE_ZSTD)
+      return true;
+#else
+      return false;
+#endif
+  }
+  return false;
+}
+
+/**
+  \brief Return the suffix that is added to the name of a compressed file, including the '.'
+ */
+const char *LogCompressor::getSuffix (Method method)
+{
+  return Zstd == method ? ".zst" : ".gz";
+}
+
+void LogCompressor::run ()
+{
+  lowerPriority ();
+  for (;;)
+  {
+    std::string filename;
+    {
+      std::unique_lock<std::mutex> lock (m_mutex);
+      m_available.wait (lock, [this] { return !m_files.empty () || m_stopping; });
+      if (m_files.empty ())
+      {
+        break;
+      }
+      filename = m_files.front ();
+      m_files.pop_front ();
+    }
+    compressFile (filename);
+    if (m_done)
+    {
+      m_done (filename);
+    }
+  }
+}
+
+void LogCompressor::lowerPriority ()
+{
+#if defined(_WIN32)
+  SetThreadPriority (GetCurrentThread (), THREAD_PRIORITY_IDLE);
+#elif defined(__linux__)
+  // On Linux both apply to the calling thread only
+  pid_t tid = (pid_t)syscall (SYS_gettid);
+  setpriority (PRIO_PROCESS, tid, 19);
+  const int ioprio_who_process = 1;
+  const int ioprio_class_idle = 3;
+  const int ioprio_class_shift = 13;
+  syscall (SYS_ioprio_set, ioprio_who_process, tid, ioprio_class_idle << ioprio_class_shift);
+#endif
+}
+
+/**
+  \brief Compress a file and replace it by the compressed version
+ */
+bool LogCompressor::compressFile (const std::string &filename)
+{
+  std::string target = filename + getSuffix (m_method);
+  std::string temporary = target + ".tmp";
+
+  bool ok = false;
+  switch (m_method)
+  {
+    case Gzip:
+      ok = gzipFile (filename, temporary);
+      break;
+    case Zstd:
+      ok = zstdFile (filename, temporary);
+      break;
+  }
+  if (!ok)
+  {
+    remove (temporary.c_str ());
+    return false;
+  }
+
+#if !defined(_WIN32)
+  // Keep the time of the original, which FileOutput uses to find the oldest files
+  struct stat file_stat;
+  if (0 == stat (filename.c_str (), &file_stat))
+  {
+    struct timeval times[2];
+    times[0].tv_sec = file_stat.st_atime;
+    times[0].tv_usec = 0;
+    times[1].tv_sec = file_stat.st_mtime;
+    times[1].tv_usec = 0;
+    utimes (temporary.c_str (), times);
+  }
+#endif
+  if (rename (temporary.c_str (), target.c_str ()))
+  {
+    remove (temporary.c_str ());
+    return false;
+  }
+  remove (filename.c_str ());
+  return true;
+}
+
+bool LogCompressor::gzipFile (const std::string &source, const std::string &target)
+{
+#if defined(HAVE_ZLIB)
+  FILE *in = fopen (source.c_str (), "rb");
+  if (nullptr == in)
+  {
+    return false;
+  }
+  char mode[8] = "wb";
+  if (m_level >= 1 && m_level <= 9)
+  {
+    snprintf (mode, sizeof (mode), "wb%d", m_level);
+  }
+  gzFile out = gzopen (target.c_str (), mode);
+  if (nullptr == out)
+  {
+    fclose (in);
+    return false;
+  }
+  gzbuffer (out, (unsigned int)s_chunkSize);
+
+  std::vector<char> buf (s_chunkSize);
+  bool ok = true;
+  size_t length;
+  while (ok && (length = fread (&buf[0], 1, buf.size (), in)) > 0)
+  {
+    ok = gzwrite (out, &buf[0], (unsigned int)length) == (int)length;
+  }
+  ok = ok && !ferror (in);
+  fclose (in);
+  return Z_OK == gzclose (out) && ok;
+#else
+  (void)source;
+  (void)target;
+  return false;
+#endif
+}
+
+bool LogCompressor::zstdFile (const std::string &source, const std::string &target)
+{
+#if defined(HAVE_ZSTD)
+  FILE *in = fopen (source.c_str (), "rb");
+  if (nullptr == in)
+  {
+    return false;
+  }
+  FILE *out = fopen (target.c_str (), "wb");
+  if (nullptr == out)
+  {
+    fclose (in);
+    return false;
+  }
+  ZSTD_CCtx *context = ZSTD_createCCtx ();
+  if (nullptr == context)
+  {
+    fclose (in);
+    fclose (out);
+    return false;
+  }
+  ZSTD_CCtx_setParameter (context, ZSTD_c_compressionLevel, m_level);
+
+  std::vector<char> in_buf (s_chunkSize);
+  std::vector<char> out_buf (ZSTD_CStreamOutSize ());
+  bool ok = true;
+  while (ok)
+  {
+    size_t length = fread (&in_buf[0], 1, in_buf.size (), in);
+    bool last = length < in_buf.size ();
+    ZSTD_inBuffer input = { &in_buf[0], length, 0 };
+    bool finished = false;
+    while (ok && !finished)
+    {
+      ZSTD_outBuffer output = { &out_buf[0], out_buf.size (), 0 };
+      size_t remaining = ZSTD_compressStream2 (context, &output, &input, last ? ZSTD_e_end : ZSTD_e_continue);
+      ok = !ZSTD_isError (remaining) && fwrite (&out_buf[0], 1, output.pos, out) == output.pos;
+      finished = last ? 0 == remaining : input.pos == input.size;
+    }
+    if (last)
+    {
+      break;
+    }
+  }
+  ok = ok && !ferror (in);
+  ZSTD_freeCCtx (context);
+  fclose (in);
+  return 0 == fclose (out) && ok;
+#else
+  (void)source;
+  (void)target;
+  return false;
+#endif
+}
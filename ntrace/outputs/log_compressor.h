@@ -0,0 +1,69 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace NTrace
+{
+
+/**
+  \brief Compresses rotated log files on a thread of its own
+
+  FileOutput hands over each file it has rotated; the file is compressed to a
+  temporary file next to it, which then gets the name of the original plus ".gz"
+  or ".zst" and the modification time of the original. The original is removed
+  afterwards, so there is always at least one complete copy on disk.
+
+  The thread runs with the lowest CPU priority and, on Linux, idle I/O priority,
+  so it only uses what the rest of the system leaves over.
+
+  After each file the handler that was passed to the constructor is called on
+  the compression thread, whether the file could be compressed or not; FileOutput
+  purges old files at that point.
+
+  Gzip needs zlib, zstd needs libzstd; both are detected by configure. Use
+  isAvailable() to find out what the library was built with.
+*/
+class LogCompressor
+{
+public:
+  enum Method
+  {
+    Gzip,
+    Zstd
+  };
+
+  /// Called with the name of the original file when it has been handled
+  typedef std::function<void (const std::string &filename)> DoneHandler;
+
+  LogCompressor (Method method, int level, const DoneHandler &done);
+  ~LogCompressor ();
+
+  void add (const std::string &filename);
+
+  static bool isAvailable (Method method);
+  static const char *getSuffix (Method method);
+
+private:
+  void run ();
+  void lowerPriority ();
+  bool compressFile (const std::string &filename);
+  bool gzipFile (const std::string &source, const std::string &target);
+  bool zstdFile (const std::string &source, const std::string &target);
+
+  Method m_method;
+  int m_level;
+  DoneHandler m_done;
+
+  std::mutex m_mutex;
+  std::condition_variable m_available;
+  std::deque<std::string> m_files;
+  bool m_stopping;
+  std::thread m_thread;
+};
+
+} // namespace
@@ -0,0 +1,200 @@
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "profile_output.h"
+
+
+using namespace NTrace;
+
+/// Name of a function ID, or "?" if the manager does not know it
+static const char *functionName (uint32_t function_id)
+{
+  const char *name = IManager::getFunctionName (function_id);
+  return name ? name : "?";
+}
+
+/**
+\brief ProfileOutput constructor
+\param filename Name of the file the profile is written to; it is overwritten
+\param format The file format
+\param max_call_paths Maximum number of distinct call paths kept in memory; calls
+  along further paths are counted as time of their caller
+ */
+ProfileOutput::ProfileOutput (const std::string &filename, Format format, size_t max_call_paths)
+  : OutputBase ("ntrace.profile_output"), m_filename (filename), m_format (format), m_tree (max_call_paths)
+{
+}
+
+ProfileOutput::~ProfileOutput ()
+{
+  write ();
+}
+
+void ProfileOutput::saveMessage (const Message &msg)
+{
+  if (0 == msg.functionId)
+  {
+    return;
+  }
+  if (Message::Entry == msg.type)
+  {
+    std::lock_guard<std::mutex> lock (m_mutex);
+    m_tree.enter (msg.tid, msg.functionId, msg.timestamp);
+  }
+  else if (Message::Exit == msg.type)
+  {
+    std::lock_guard<std::mutex> lock (m_mutex);
+    m_tree.exit (msg.tid, msg.functionId, msg.timestamp);
+  }
+}
+
+/**
+\brief Write the profile so far to the file
+\return false if the file could not be written
+
+Calls that are still in progress are not included.
+ */
+bool ProfileOutput::write ()
+{
+  std::ofstream out (m_filename.c_str (), std::ios::out | std::ios::trunc);
+  if (!out.is_open ())
+  {
+    return false;
+  }
+  dump (out);
+  out.close ();
+  return !out.fail ();
+}
+
+/**
+\brief Write the profile so far to a stream, in the format of this output
+ */
+void ProfileOutput::dump (std::ostream &out) const
+{
+  std::lock_guard<std::mutex> lock (m_mutex);
+  if (Callgrind == m_format)
+  {
+    dumpCallgrind (out);
+  }
+  else
+  {
+    dumpFoldedStacks (out);
+  }
+}
+
+/**
+\brief Forget the profile
+ */
+void ProfileOutput::reset ()
+{
+  std::lock_guard<std::mutex> lock (m_mutex);
+  m_tree.reset ();
+}
+
+/**
+\brief Write one line per call path with its exclusive time
+
+The ';' separates the frames, so it is replaced inside function names.
+ */
+void ProfileOutput::dumpFoldedStacks (std::ostream &out) const
+{
+  const std::vector<CallTree::Node> &nodes = m_tree.getNodes ();
+  // Parents come before their children, so each path is its parent's path plus one name
+  std::vector<std::string> paths (nodes.size ());
+  for (size_t i = 0; i < nodes.size (); i++)
+  {
+    std::string name = functionName (nodes[i].functionId);
+    for (std::string::iterator c = name.begin (); c != name.end (); ++c)
+    {
+      if (';' == *c)
+      {
+        *c = ':';
+      }
+    }
+    if (nodes[i].parent != CallTree::s_root)
+    {
+      paths[i] = paths[nodes[i].parent] + ";" + name;
+    }
+    else
+    {
+      paths[i] = name;
+    }
+
+    if (nodes[i].exclusive > 0)
+    {
+      out << paths[i] << ' ' << nodes[i].exclusive << '\n';
+    }
+  }
+}
+
+/**
+\brief Write a callgrind profile
+
+Callgrind works per function rather than per path, so the nodes of a function
+are added up, as are the calls between each pair of functions. There are no
+source positions; every cost is given at line 0.
+ */
+void ProfileOutput::dumpCallgrind (std::ostream &out) const
+{
+  struct Call
+  {
+    uint64_t calls;
+    uint64_t inclusive;
+  };
+  struct Function
+  {
+    uint64_t exclusive;
+    std::map<uint32_t, Call> callees;
+  };
+
+  const std::vector<CallTree::Node> &nodes = m_tree.getNodes ();
+  std::map<uint32_t, Function> functions;
+  uint64_t total = 0;
+  for (size_t i = 0; i < nodes.size (); i++)
+  {
+    const CallTree::Node &node = nodes[i];
+    functions[node.functionId].exclusive += node.exclusive;
+    total += node.exclusive;
+    if (node.parent != CallTree::s_root)
+    {
+      Call &call = functions[nodes[node.parent].functionId].callees[node.functionId];
+      call.calls += node.calls;
+      call.inclusive += node.inclusive;
+    }
+  }
+
+  out << "# callgrind format\n";
+  out << "version: 1\n";
+  out << "creator: ntrace\n";
+  out << "positions: line\n";
+  out << "events: Nanoseconds\n";
+  out << "summary: " << total << "\n\n";
+
+  // Function names are compressed: the full name is only given the first time
+  std::map<uint32_t, bool> named;
+  for (std::map<uint32_t, Function>::const_iterator it = functions.begin (); it != functions.end (); ++it)
+  {
+    out << "fn=(" << it->first << ")";
+    if (!named[it->first])
+    {
+      out << " " << functionName (it->first);
+      named[it->first] = true;
+    }
+    out << "\n0 " << it->second.exclusive << "\n";
+
+    for (std::map<uint32_t, Call>::const_iterator callee = it->second.callees.begin (); callee != it->second.callees.end (); ++callee)
+    {
+      out << "cfn=(" << callee->first << ")";
+      if (!named[callee->first])
+      {
+        out << " " << functionName (callee->first);
+        named[callee->first] = true;
+      }
+      out << "\ncalls=" << callee->second.calls << " 0\n";
+      out << "0 " << callee->second.inclusive << "\n";
+    }
+    out << "\n";
+  }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <mutex>
+#include <ostream>
+
+#include "../call_tree.h"
+#include "../interfaces.h"
+#include "../output_base.h"
+
+namespace NTrace
+{
+
+
+/**
+\brief Output that builds a profile of the traced functions
+
+Rebuilds the call stacks of every thread from the Entry and Exit messages (as
+generated by TR_FUNC) and adds up the time spent along each call path in a
+CallTree. The profile is kept in memory and written to a file when the output is
+destroyed, or earlier with write().
+
+Two formats are supported:
+- FoldedStacks: one line per call path with its exclusive time in nanoseconds,
+  e.g. "main;parse;readToken 12345". This is the input of flamegraph.pl and can
+  be loaded in speedscope.
+- Callgrind: a callgrind profile with the exclusive time of every function and
+  the number of calls and inclusive time of every caller/callee pair; open it
+  with KCachegrind.
+
+getName() returns the fixed string "ntrace.profile_output".
+
+*/
+class ProfileOutput : public OutputBase
+{
+public:
+  enum Format
+  {
+    FoldedStacks,
+    Callgrind
+  };
+
+  NTRACE_EXPORT ProfileOutput (const std::string &filename, Format format, size_t max_call_paths = 100000);
+  ~ProfileOutput ();
+
+  virtual void NTRACE_CALL saveMessage (const Message &msg);
+
+  NTRACE_EXPORT bool write ();
+  NTRACE_EXPORT void dump (std::ostream &out) const;
+  NTRACE_EXPORT void reset ();
+
+private:
+  void dumpFoldedStacks (std::ostream &out) const;
+  void dumpCallgrind (std::ostream &out) const;
+
+  std::string m_filename;
+  Format m_format;
+
+  mutable std::mutex m_mutex;
+  CallTree m_tree;
+};
+
+}
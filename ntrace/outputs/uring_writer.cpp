@@ -0,0 +1,572 @@
+#include "uring_writer.h"
+
+#if defined(HAVE_IO_URING)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+using namespace NTrace;
+
+/// user_data of the fdatasync requests; writes use the index of their buffer
+static const uint64_t s_syncTag = ~(uint64_t)0;
+
+/**
+  \brief Constructor
+  \param buffer_size Size of each buffer; the largest write that is submitted at once
+  \param buffer_count Number of buffers, so at most one less write is in flight
+ */
+UringWriter::UringWriter (size_t buffer_size, unsigned int buffer_count)
+  : m_bufferSize (buffer_size), m_current (0), m_fd (-1), m_size (0), m_failed (false), m_syncsInFlight (0),
+    m_ring (-1), m_fixedBuffers (false), m_sqRing (nullptr), m_sqRingSize (0), m_cqRing (nullptr), m_cqRingSize (0),
+    m_sqes (nullptr), m_sqesSize (0), m_toSubmit (0)
+{
+  if (buffer_count < 2)
+  {
+    buffer_count = 2;
+  }
+  size_t page = (size_t)sysconf (_SC_PAGESIZE);
+  m_bufferSize = (buffer_size + page - 1) / page * page;
+  if (0 == m_bufferSize)
+  {
+    m_bufferSize = page;
+  }
+
+  std::vector<struct iovec> iovecs;
+  for (unsigned int i = 0; i < buffer_count; i++)
+  {
+    void *data = nullptr;
+    if (posix_memalign (&data, page, m_bufferSize) != 0)
+    {
+      break;
+    }
+    Buffer buffer = { (char *)data, 0, 0, false };
+    m_buffers.push_back (buffer);
+    struct iovec iov = { data, m_bufferSize };
+    iovecs.push_back (iov);
+  }
+  if (m_buffers.size () < 2)
+  {
+    // Nothing to gain from io_uring without a second buffer
+    return;
+  }
+
+  // Room for a write per buffer plus a sync after each of them
+  if (setupRing (2 * (unsigned int)m_buffers.size ()))
+  {
+    // Fixed buffers save the kernel mapping the pages for every write; this may
+    // fail if the locked memory limit is low, in which case plain writes are used.
+    m_fixedBuffers = 0 == syscall (__NR_io_uring_register, m_ring, IORING_REGISTER_BUFFERS, &iovecs[0], (unsigned int)iovecs.size ());
+  }
+}
+
+UringWriter::~UringWriter ()
+{
+  close ();
+  teardownRing ();
+  for (std::vector<Buffer>::iterator it = m_buffers.begin (); it != m_buffers.end (); ++it)
+  {
+    free (it->data);
+  }
+}
+
+bool UringWriter::open (const std::string &filename)
+{
+  close ();
+  m_fd = ::open (filename.c_str (), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+  if (m_fd < 0)
+  {
+    return false;
+  }
+  struct stat file_stat;
+  if (fstat (m_fd, &file_stat) < 0)
+  {
+    close ();
+    return false;
+  }
+  m_size = file_stat.st_size;
+  m_failed = false;
+  return true;
+}
+
+bool UringWriter::isOpen () const
+{
+  return m_fd >= 0;
+}
+
+bool UringWriter::write (const char *data, size_t length)
+{
+  if (m_fd < 0)
+  {
+    return false;
+  }
+  if (m_buffers.empty ())
+  {
+    bool ok = writeDirect (data, length, m_size);
+    m_size += length;
+    return ok;
+  }
+
+  while (length > 0)
+  {
+    Buffer &buffer = m_buffers[m_current];
+    if (0 == buffer.used)
+    {
+      buffer.offset = m_size;
+    }
+    size_t room = m_bufferSize - buffer.used;
+    if (0 == room)
+    {
+      submitBuffer ();
+      continue;
+    }
+    size_t part = length < room ? length : room;
+    memcpy (buffer.data + buffer.used, data, part);
+    buffer.used += part;
+    m_size += part;
+    data += part;
+    length -= part;
+  }
+  return !m_failed;
+}
+
+/**
+  \brief Submit the buffer that is being filled; does not wait for it
+ */
+void UringWriter::flush ()
+{
+  if (m_fd >= 0 && !m_buffers.empty ())
+  {
+    submitBuffer ();
+  }
+}
+
+/**
+  \brief Submit the buffer and queue an fdatasync after it
+
+  With io_uring the sync is done in the background: it is ordered after all
+  writes that were submitted before it, and a failure is reported by a later
+  call. Without io_uring this waits for the sync.
+ */
+bool UringWriter::sync ()
+{
+  if (m_fd < 0)
+  {
+    return false;
+  }
+  flush ();
+  if (m_ring < 0)
+  {
+    if (fdatasync (m_fd) < 0)
+    {
+      m_failed = true;
+    }
+    return !m_failed;
+  }
+
+  reap ();
+  io_uring_sqe *sqe = getSqe ();
+  sqe->opcode = IORING_OP_FSYNC;
+  sqe->flags = IOSQE_IO_DRAIN;
+  sqe->fd = m_fd;
+  sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+  sqe->user_data = s_syncTag;
+  m_syncsInFlight++;
+  if (!submit (false))
+  {
+    takeBackEntries ();
+  }
+  return !m_failed;
+}
+
+/**
+  \brief Write what is buffered, wait until all writes and syncs are done, and close the file
+ */
+void UringWriter::close ()
+{
+  if (m_fd < 0)
+  {
+    return;
+  }
+  flush ();
+  waitForAll ();
+  ::close (m_fd);
+  m_fd = -1;
+  m_size = 0;
+}
+
+uint64_t UringWriter::getSize () const
+{
+  return m_size;
+}
+
+/**
+  \brief Create the ring and map its queues into our memory
+  \param entries Minimum number of submission queue entries
+ */
+bool UringWriter::setupRing (unsigned int entries)
+{
+  struct io_uring_params params;
+  memset (&params, 0, sizeof (params));
+  m_ring = (int)syscall (__NR_io_uring_setup, entries, &params);
+  if (m_ring < 0)
+  {
+    m_ring = -1;
+    return false;
+  }
+
+  m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof (unsigned int);
+  m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof (struct io_uring_cqe);
+  bool single_mmap = 0 != (params.features & IORING_FEAT_SINGLE_MMAP);
+  if (single_mmap)
+  {
+    m_sqRingSize = m_cqRingSize = m_sqRingSize > m_cqRingSize ? m_sqRingSize : m_cqRingSize;
+  }
+
+  void *map = mmap (nullptr, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring, IORING_OFF_SQ_RING);
+  if (MAP_FAILED == map)
+  {
+    teardownRing ();
+    return false;
+  }
+  m_sqRing = map;
+  if (single_mmap)
+  {
+    m_cqRing = m_sqRing;
+  }
+  else
+  {
+    map = mmap (nullptr, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring, IORING_OFF_CQ_RING);
+    if (MAP_FAILED == map)
+    {
+      teardownRing ();
+      return false;
+    }
+    m_cqRing = map;
+  }
+  m_sqesSize = params.sq_entries * sizeof (struct io_uring_sqe);
+  map = mmap (nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring, IORING_OFF_SQES);
+  if (MAP_FAILED == map)
+  {
+    teardownRing ();
+    return false;
+  }
+  m_sqes = (io_uring_sqe *)map;
+
+  char *sq = (char *)m_sqRing;
+  m_sqHead = (unsigned int *)(sq + params.sq_off.head);
+  m_sqTail = (unsigned int *)(sq + params.sq_off.tail);
+  m_sqMask = *(unsigned int *)(sq + params.sq_off.ring_mask);
+  m_sqArray = (unsigned int *)(sq + params.sq_off.array);
+  m_sqEntries = params.sq_entries;
+  m_sqLocalTail = *m_sqTail;
+
+  char *cq = (char *)m_cqRing;
+  m_cqHead = (unsigned int *)(cq + params.cq_off.head);
+  m_cqTail = (unsigned int *)(cq + params.cq_off.tail);
+  m_cqMask = *(unsigned int *)(cq + params.cq_off.ring_mask);
+  m_cqes = (io_uring_cqe *)(cq + params.cq_off.cqes);
+  return true;
+}
+
+void UringWriter::teardownRing ()
+{
+  if (m_sqes)
+  {
+    munmap (m_sqes, m_sqesSize);
+    m_sqes = nullptr;
+  }
+  if (m_cqRing && m_cqRing != m_sqRing)
+  {
+    munmap (m_cqRing, m_cqRingSize);
+  }
+  m_cqRing = nullptr;
+  if (m_sqRing)
+  {
+    munmap (m_sqRing, m_sqRingSize);
+    m_sqRing = nullptr;
+  }
+  if (m_ring >= 0)
+  {
+    // Also releases the registered buffers
+    ::close (m_ring);
+    m_ring = -1;
+  }
+  m_fixedBuffers = false;
+}
+
+/**
+  \brief Return a cleared submission queue entry; it is passed to the kernel by the next submit()
+ */
+io_uring_sqe *UringWriter::getSqe ()
+{
+  while (m_sqLocalTail - __atomic_load_n (m_sqHead, __ATOMIC_ACQUIRE) >= m_sqEntries)
+  {
+    // Cannot happen as long as every entry is submitted right away; but be safe
+    if (!submit (true))
+    {
+      takeBackEntries ();
+      break;
+    }
+    reap ();
+  }
+  unsigned int index = m_sqLocalTail & m_sqMask;
+  io_uring_sqe *sqe = &m_sqes[index];
+  memset (sqe, 0, sizeof (*sqe));
+  m_sqArray[index] = index;
+  m_sqLocalTail++;
+  m_toSubmit++;
+  return sqe;
+}
+
+/**
+  \brief Pass the new entries to the kernel
+  \param wait Also wait until at least one request has completed
+ */
+bool UringWriter::submit (bool wait)
+{
+  __atomic_store_n (m_sqTail, m_sqLocalTail, __ATOMIC_RELEASE);
+  for (;;)
+  {
+    long ret = syscall (__NR_io_uring_enter, m_ring, m_toSubmit, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+    if (ret >= 0)
+    {
+      m_toSubmit -= (unsigned int)ret < m_toSubmit ? (unsigned int)ret : m_toSubmit;
+      return true;
+    }
+    if (EINTR != errno)
+    {
+      return false;
+    }
+  }
+}
+
+/**
+  \brief Handle all completions that are waiting
+ */
+void UringWriter::reap ()
+{
+  unsigned int head = *m_cqHead;
+  unsigned int tail = __atomic_load_n (m_cqTail, __ATOMIC_ACQUIRE);
+  while (head != tail)
+  {
+    const io_uring_cqe &cqe = m_cqes[head & m_cqMask];
+    uint64_t user_data = cqe.user_data;
+    int result = cqe.res;
+    head++;
+    __atomic_store_n (m_cqHead, head, __ATOMIC_RELEASE);
+    complete (user_data, result);
+  }
+}
+
+/**
+  \brief Finish a request
+
+  A write that failed or was cut short is finished with pwrite(); this also
+  covers kernels that do not know the request.
+ */
+void UringWriter::complete (uint64_t user_data, int result)
+{
+  if (s_syncTag == user_data)
+  {
+    if (m_syncsInFlight > 0)
+    {
+      m_syncsInFlight--;
+    }
+    if (result < 0)
+    {
+      m_failed = true;
+    }
+    return;
+  }
+
+  Buffer &buffer = m_buffers[(size_t)user_data];
+  size_t done = result > 0 ? (size_t)result : 0;
+  if (done < buffer.used)
+  {
+    writeDirect (buffer.data + done, buffer.used - done, buffer.offset + done);
+  }
+  buffer.used = 0;
+  buffer.inFlight = false;
+}
+
+/**
+  \brief Take back the entries that the kernel has not picked up, after io_uring_enter() failed
+
+  Otherwise a later io_uring_enter() would still submit them, while their buffers
+  hold other data by then. Their writes are done with pwrite(); their syncs with
+  fdatasync(), after the writes that the kernel did pick up have completed.
+ */
+void UringWriter::takeBackEntries ()
+{
+  // The kernel only reads the ring inside io_uring_enter(), which is ours to call
+  unsigned int head = __atomic_load_n (m_sqHead, __ATOMIC_ACQUIRE);
+  unsigned int tail = m_sqLocalTail;
+  m_sqLocalTail = head;
+  __atomic_store_n (m_sqTail, head, __ATOMIC_RELEASE);
+  m_toSubmit = 0;
+
+  unsigned int syncs = 0;
+  for (unsigned int i = head; i != tail; i++)
+  {
+    uint64_t user_data = m_sqes[i & m_sqMask].user_data;
+    if (s_syncTag == user_data)
+    {
+      syncs++;
+    }
+    else
+    {
+      complete (user_data, 0);
+    }
+  }
+  if (syncs > 0)
+  {
+    for (std::vector<Buffer>::iterator it = m_buffers.begin (); it != m_buffers.end (); ++it)
+    {
+      while (it->inFlight)
+      {
+        pollCompletions ();
+      }
+    }
+    if (fdatasync (m_fd) < 0)
+    {
+      m_failed = true;
+    }
+    m_syncsInFlight -= syncs < m_syncsInFlight ? syncs : m_syncsInFlight;
+  }
+}
+
+/**
+  \brief Wait a moment for completions without io_uring_enter(), then handle them
+
+  The kernel posts them to the ring by itself; the sleep also gives it the chance
+  to run work it has queued for this thread.
+ */
+void UringWriter::pollCompletions ()
+{
+  usleep (100);
+  reap ();
+}
+
+/**
+  \brief Submit the current buffer and make sure the next one can be filled
+ */
+bool UringWriter::submitBuffer ()
+{
+  Buffer &buffer = m_buffers[m_current];
+  if (0 == buffer.used)
+  {
+    return true;
+  }
+
+  bool ok = true;
+  if (m_ring < 0)
+  {
+    ok = writeDirect (buffer.data, buffer.used, buffer.offset);
+    buffer.used = 0;
+    return ok;
+  }
+
+  io_uring_sqe *sqe = getSqe ();
+  sqe->fd = m_fd;
+  sqe->off = buffer.offset;
+  sqe->addr = (uint64_t)(uintptr_t)buffer.data;
+  sqe->len = (uint32_t)buffer.used;
+  sqe->user_data = m_current;
+  if (m_fixedBuffers)
+  {
+    sqe->opcode = IORING_OP_WRITE_FIXED;
+    sqe->buf_index = (uint16_t)m_current;
+  }
+  else
+  {
+    sqe->opcode = IORING_OP_WRITE;
+  }
+  buffer.inFlight = true;
+  if (!submit (false))
+  {
+    takeBackEntries ();
+    ok = !m_failed;
+  }
+
+  m_current = (m_current + 1) % m_buffers.size ();
+  waitForBuffer (m_buffers[m_current]);
+  return ok;
+}
+
+/**
+  \brief Write with pwrite(), on the calling thread
+ */
+bool UringWriter::writeDirect (const char *data, size_t length, uint64_t offset)
+{
+  while (length > 0)
+  {
+    ssize_t written = pwrite (m_fd, data, length, (off_t)offset);
+    if (written < 0)
+    {
+      if (EINTR == errno)
+      {
+        continue;
+      }
+      m_failed = true;
+      return false;
+    }
+    data += written;
+    length -= (size_t)written;
+    offset += (uint64_t)written;
+  }
+  return true;
+}
+
+void UringWriter::waitForBuffer (Buffer &buffer)
+{
+  reap ();
+  while (buffer.inFlight)
+  {
+    if (!submit (true))
+    {
+      // If the kernel has the request, the buffer stays in use until it completes
+      takeBackEntries ();
+      while (buffer.inFlight)
+      {
+        pollCompletions ();
+      }
+      return;
+    }
+    reap ();
+  }
+}
+
+void UringWriter::waitForAll ()
+{
+  if (m_ring < 0)
+  {
+    return;
+  }
+  for (std::vector<Buffer>::iterator it = m_buffers.begin (); it != m_buffers.end (); ++it)
+  {
+    waitForBuffer (*it);
+  }
+  while (m_syncsInFlight > 0)
+  {
+    if (!submit (true))
+    {
+      takeBackEntries ();
+      while (m_syncsInFlight > 0)
+      {
+        pollCompletions ();
+      }
+      return;
+    }
+    reap ();
+  }
+}
+
+#endif
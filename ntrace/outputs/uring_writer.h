@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "file_writer.h"
+
+#if defined(HAVE_IO_URING)
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace NTrace
+{
+
+/**
+  \brief Writer that hands its writes to the kernel through io_uring
+
+  Data is copied into one of a small number of buffers (registered with the
+  kernel, if it allows that). When a buffer is full, or at flush(), it is submitted
+  as a write at its offset in the file and the next buffer is used, so several
+  writes are in flight while the caller goes on. The caller only waits when all
+  buffers are still being written; that is, when the disk can not keep up.
+
+  sync() queues an fdatasync behind the writes that were submitted before it and
+  does not wait for it. close() waits for everything that is in flight.
+
+  When io_uring is not available (old kernel, or blocked by a seccomp filter) the
+  writer falls back to pwrite() and fdatasync() on the calling thread. Writes
+  that the kernel only completes in part are finished the same way, and so are
+  the requests that it has not picked up when io_uring_enter() fails.
+*/
+class UringWriter : public FileWriter
+{
+public:
+  UringWriter (size_t buffer_size, unsigned int buffer_count);
+  ~UringWriter ();
+
+  virtual bool open (const std::string &filename);
+  virtual bool isOpen () const;
+  virtual bool write (const char *data, size_t length);
+  virtual void flush ();
+  virtual bool sync ();
+  virtual void close ();
+  virtual uint64_t getSize () const;
+
+  /// True if the writes go through io_uring, false if the writer fell back to pwrite()
+  bool isAsynchronous () const
+  {
+    return m_ring >= 0;
+  }
+
+private:
+  struct Buffer
+  {
+    char *data;
+    size_t used;      ///< Bytes of data in the buffer
+    uint64_t offset;  ///< Where the data goes in the file
+    bool inFlight;    ///< Submitted and not completed yet
+  };
+
+  bool setupRing (unsigned int entries);
+  void teardownRing ();
+  io_uring_sqe *getSqe ();
+  bool submit (bool wait);
+  void reap ();
+  void complete (uint64_t user_data, int result);
+  void takeBackEntries ();
+  void pollCompletions ();
+  bool submitBuffer ();
+  bool writeDirect (const char *data, size_t length, uint64_t offset);
+  void waitForBuffer (Buffer &buffer);
+  void waitForAll ();
+
+  size_t m_bufferSize;
+  std::vector<Buffer> m_buffers;
+  unsigned int m_current; ///< Buffer that is being filled
+
+  int m_fd;
+  uint64_t m_size;
+  bool m_failed;          ///< A write failed; reported by the next write() or sync()
+  unsigned int m_syncsInFlight;
+
+  // The ring; m_ring is -1 when io_uring is not used
+  int m_ring;
+  bool m_fixedBuffers;
+  void *m_sqRing;
+  size_t m_sqRingSize;
+  void *m_cqRing;
+  size_t m_cqRingSize;
+  io_uring_sqe *m_sqes;
+  size_t m_sqesSize;
+  unsigned int *m_sqHead;
+  unsigned int *m_sqTail;
+  unsigned int m_sqMask;
+  unsigned int *m_sqArray;
+  unsigned int m_sqEntries;
+  unsigned int m_sqLocalTail; ///< Our copy of the tail, including entries that are not published yet
+  unsigned int m_toSubmit;    ///< Entries the kernel has not taken yet
+  unsigned int *m_cqHead;
+  unsigned int *m_cqTail;
+  unsigned int m_cqMask;
+  io_uring_cqe *m_cqes;
+};
+
+} // namespace
+
+#endif
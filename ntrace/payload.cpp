@@ -0,0 +1,153 @@
+#include <string.h>
+
+#include <utility>
+
+#include "payload.h"
+#include "slab_pool.h"
+
+using namespace NTrace;
+
+Payload::Payload ()
+  : m_data (m_inline), m_size (0), m_capacity (0)
+{
+  m_inline[0] = '\0';
+}
+
+Payload::Payload (const Payload &other)
+  : m_data (m_inline), m_size (0), m_capacity (0)
+{
+  m_inline[0] = '\0';
+  assign (other.m_data, other.m_size);
+}
+
+/**
+  \brief Move constructor
+
+  Takes over the block of \p other if it has one; \p other is left empty.
+ */
+Payload::Payload (Payload &&other) noexcept
+  : m_data (m_inline), m_size (0), m_capacity (0)
+{
+  m_inline[0] = '\0';
+  *this = std::move (other);
+}
+
+Payload::~Payload ()
+{
+  if (m_capacity > 0)
+  {
+    SlabPool::release (m_data, m_capacity);
+  }
+}
+
+Payload &Payload::operator= (const Payload &other)
+{
+  if (this != &other)
+  {
+    assign (other.m_data, other.m_size);
+  }
+  return *this;
+}
+
+Payload &Payload::operator= (Payload &&other) noexcept
+{
+  if (this == &other)
+  {
+    return *this;
+  }
+  if (other.m_capacity > 0)
+  {
+    if (m_capacity > 0)
+    {
+      SlabPool::release (m_data, m_capacity);
+    }
+    m_data = other.m_data;
+    m_size = other.m_size;
+    m_capacity = other.m_capacity;
+  }
+  else
+  {
+    // Short text; copying it is cheaper than anything else. Our own block, if any, is kept.
+    memcpy (m_data, other.m_data, other.m_size + 1);
+    m_size = other.m_size;
+  }
+  other.m_data = other.m_inline;
+  other.m_size = 0;
+  other.m_capacity = 0;
+  other.m_inline[0] = '\0';
+  return *this;
+}
+
+Payload &Payload::operator= (const std::string &text)
+{
+  assign (text.data (), text.size ());
+  return *this;
+}
+
+Payload &Payload::operator= (const char *text)
+{
+  assign (text);
+  return *this;
+}
+
+void Payload::clear ()
+{
+  m_size = 0;
+  m_data[0] = '\0';
+}
+
+void Payload::assign (const char *text, size_t length)
+{
+  m_size = 0;
+  reserve (length);
+  memcpy (m_data, text, length);
+  m_size = length;
+  m_data[m_size] = '\0';
+}
+
+void Payload::append (const char *text, size_t length)
+{
+  reserve (m_size + length);
+  memcpy (m_data + m_size, text, length);
+  m_size += length;
+  m_data[m_size] = '\0';
+}
+
+void Payload::assign (const char *text)
+{
+  assign (text, strlen (text));
+}
+
+void Payload::append (const char *text)
+{
+  append (text, strlen (text));
+}
+
+/**
+  \brief Make room for \p length characters plus the terminating zero
+
+  Keeps the current text.
+ */
+void Payload::reserve (size_t length)
+{
+  size_t current = (m_capacity > 0) ? m_capacity : sizeof (m_inline);
+  if (length < current)
+  {
+    return;
+  }
+
+  // Grow by at least a factor 2, so repeated appends stay cheap
+  size_t size = length + 1;
+  if (size < 2 * current)
+  {
+    size = 2 * current;
+  }
+  char *block = static_cast<char *> (SlabPool::allocate (size));
+  memcpy (block, m_data, m_size + 1);
+  if (m_capacity > 0)
+  {
+    SlabPool::release (m_data, m_capacity);
+  }
+  m_data = block;
+  m_capacity = size;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+
+#include "ntrace_exports.h"
+
+namespace NTrace
+{
+
+/**
+  \brief Text of a message
+
+  A string with room for a short text inside the object itself, so typical log
+  lines never cause a heap allocation. Longer texts spill over into blocks from
+  the SlabPool. Moving a Payload copies at most the inline part and never allocates.
+
+  The text is always zero terminated. It offers the few string operations that
+  NTrace needs; use str() to get a real std::string.
+*/
+class NTRACE_EXPORT Payload
+{
+public:
+  /// Number of characters that are stored inline, excluding the terminating zero
+  static const size_t s_inlineSize = 191;
+
+  Payload ();
+  Payload (const Payload &other);
+  Payload (Payload &&other) noexcept;
+  ~Payload ();
+
+  Payload &operator= (const Payload &other);
+  Payload &operator= (Payload &&other) noexcept;
+  Payload &operator= (const std::string &text);
+  Payload &operator= (const char *text);
+
+  /// The text; always zero terminated
+  const char *c_str () const
+  {
+    return m_data;
+  }
+  /// Same as c_str(); the text may contain binary data (see DeferredFormat)
+  const char *data () const
+  {
+    return m_data;
+  }
+  size_t size () const
+  {
+    return m_size;
+  }
+  size_t length () const
+  {
+    return m_size;
+  }
+  bool empty () const
+  {
+    return 0 == m_size;
+  }
+  /// Return a copy of the text as std::string
+  std::string str () const
+  {
+    return std::string (m_data, m_size);
+  }
+
+  void clear ();
+  void assign (const char *text, size_t length);
+  void append (const char *text, size_t length);
+
+  void assign (const char *text);
+  void append (const char *text);
+
+private:
+  void reserve (size_t length);
+
+  char *m_data;       ///< Points to m_inline or to a block from the SlabPool
+  size_t m_size;      ///< Length of the text
+  size_t m_capacity;  ///< Size of the block; 0 if the text is inline
+  char m_inline[s_inlineSize + 1];
+};
+
+inline std::ostream &operator<< (std::ostream &os, const Payload &payload)
+{
+  return os.write (payload.data (), payload.size ());
+}
+
+} // namespace
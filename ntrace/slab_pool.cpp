@@ -0,0 +1,99 @@
+#include <mutex>
+
+#include "slab_pool.h"
+
+using namespace NTrace;
+
+namespace
+{
+
+/// Size classes: 256, 512, ... up to SlabPool::s_maximumSize
+const int s_classCount = 9;
+/// Minimum amount of memory to allocate at once for a size class
+const size_t s_slabSize = 64 * 1024;
+
+/// Free blocks are linked through their first bytes
+struct FreeBlock
+{
+  FreeBlock *next;
+};
+
+struct SizeClass
+{
+  std::mutex mutex;
+  FreeBlock *free = nullptr;
+};
+
+SizeClass s_classes[s_classCount];
+
+/// Return the size class for \p size, or -1 if it is too large to pool
+int sizeClass (size_t size)
+{
+  size_t block = SlabPool::s_minimumSize;
+  for (int i = 0; i < s_classCount; i++, block <<= 1)
+  {
+    if (size <= block)
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+} // namespace
+
+/**
+  \brief Get a block of memory
+  \param size Minimum size of the block; on return, the actual size
+  \return The block; never null (throws std::bad_alloc like new)
+
+  The block must be returned with release(), using the size as returned here.
+ */
+void *SlabPool::allocate (size_t &size)
+{
+  int index = sizeClass (size);
+  if (index < 0)
+  {
+    return new char[size];
+  }
+
+  size = s_minimumSize << index;
+  SizeClass &cls = s_classes[index];
+  std::lock_guard<std::mutex> lock (cls.mutex);
+  if (nullptr == cls.free)
+  {
+    // Cut a new slab into blocks
+    size_t count = (size < s_slabSize) ? s_slabSize / size : 1;
+    char *slab = new char[count * size];
+    for (size_t i = 0; i < count; i++)
+    {
+      FreeBlock *block = reinterpret_cast<FreeBlock *> (slab + i * size);
+      block->next = cls.free;
+      cls.free = block;
+    }
+  }
+  FreeBlock *block = cls.free;
+  cls.free = block->next;
+  return block;
+}
+
+/**
+  \brief Return a block to the pool
+  \param block Block obtained from allocate()
+  \param size Size of the block, as returned by allocate()
+ */
+void SlabPool::release (void *block, size_t size)
+{
+  int index = sizeClass (size);
+  if (index < 0)
+  {
+    delete[] static_cast<char *> (block);
+    return;
+  }
+
+  SizeClass &cls = s_classes[index];
+  std::lock_guard<std::mutex> lock (cls.mutex);
+  FreeBlock *free = static_cast<FreeBlock *> (block);
+  free->next = cls.free;
+  cls.free = free;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+
+namespace NTrace
+{
+
+/**
+  \brief Pool of memory blocks for message text that does not fit inline
+
+  Blocks come in a few power-of-2 size classes. Freed blocks go back on the free
+  list of their class and are handed out again, so once a program has run for a
+  while, messages no longer cause calls to malloc(). Memory is taken from the
+  system in slabs of several blocks at a time and is never returned.
+
+  Requests larger than the biggest size class are passed straight to the system.
+
+  All functions are thread-safe; a block may be freed by another thread than the
+  one that allocated it.
+*/
+class SlabPool
+{
+public:
+  static void *allocate (size_t &size);
+  static void release (void *block, size_t size);
+
+  /// Smallest block size
+  static const size_t s_minimumSize = 256;
+  /// Largest block size that is pooled
+  static const size_t s_maximumSize = 64 * 1024;
+};
+
+} // namespace
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace NTrace
+{
+
+/**
+  \brief Bounded single-producer/single-consumer ring buffer
+
+  A fixed size circular buffer that can be used without locks as long as
+  there is exactly one thread pushing items and one thread popping them.
+  The capacity is rounded up to the next power of 2.
+
+  push() never blocks; if the ring is full it simply returns false and it
+  is up to the caller to decide what to do with the item.
+*/
+template <typename T>
+class SpscRing
+{
+public:
+  /**
+   \brief Constructor
+   \param capacity Minimum number of items the ring can hold
+   */
+  explicit SpscRing (size_t capacity)
+    : m_head (0), m_tail (0), m_cachedTail (0), m_cachedHead (0)
+  {
+    size_t size = 1;
+    while (size < capacity)
+    {
+      size <<= 1;
+    }
+    m_slots.resize (size);
+    m_mask = size - 1;
+  }
+
+  /**
+   \brief Add item to the ring (producer side)
+   \param item The item to copy into the ring
+   \return false if the ring is full
+   */
+  bool push (const T &item)
+  {
+    const size_t head = m_head.load (std::memory_order_relaxed);
+    if (head - m_cachedTail > m_mask)
+    {
+      // Looks full; refresh our idea of the consumer position
+      m_cachedTail = m_tail.load (std::memory_order_acquire);
+      if (head - m_cachedTail > m_mask)
+      {
+        return false;
+      }
+    }
+    m_slots[head & m_mask] = item;
+    m_head.store (head + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   \brief Move item into the ring (producer side)
+   \param item The item; left untouched if the ring is full
+   \return false if the ring is full
+   */
+  bool push (T &&item)
+  {
+    const size_t head = m_head.load (std::memory_order_relaxed);
+    if (head - m_cachedTail > m_mask)
+    {
+      m_cachedTail = m_tail.load (std::memory_order_acquire);
+      if (head - m_cachedTail > m_mask)
+      {
+        return false;
+      }
+    }
+    m_slots[head & m_mask] = std::move (item);
+    m_head.store (head + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   \brief Remove item from the ring (consumer side)
+   \param item Receives the oldest item, moved out of the ring
+   \return false if the ring is empty
+   */
+  bool pop (T &item)
+  {
+    const size_t tail = m_tail.load (std::memory_order_relaxed);
+    if (tail == m_cachedHead)
+    {
+      m_cachedHead = m_head.load (std::memory_order_acquire);
+      if (tail == m_cachedHead)
+      {
+        return false;
+      }
+    }
+    item = std::move (m_slots[tail & m_mask]);
+    m_tail.store (tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// Returns true if there is nothing to pop; may be called from either side.
+  bool empty () const
+  {
+    return m_head.load (std::memory_order_acquire) == m_tail.load (std::memory_order_acquire);
+  }
+
+  /// Number of items in the ring; only a snapshot if the other side is active
+  size_t size () const
+  {
+    return m_head.load (std::memory_order_acquire) - m_tail.load (std::memory_order_acquire);
+  }
+
+  /// Maximum number of items in the ring
+  size_t capacity () const
+  {
+    return m_mask + 1;
+  }
+
+private:
+  std::vector<T> m_slots;
+  size_t m_mask;
+
+  // Producer and consumer positions live on separate cache lines to avoid false sharing
+  alignas (64) std::atomic<size_t> m_head; ///< Next slot to write; only modified by the producer
+  alignas (64) std::atomic<size_t> m_tail; ///< Next slot to read; only modified by the consumer
+  alignas (64) size_t m_cachedTail; ///< Producer's copy of m_tail
+  alignas (64) size_t m_cachedHead; ///< Consumer's copy of m_head
+};
+
+} // namespace
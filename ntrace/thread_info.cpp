@@ -0,0 +1,160 @@
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+#include <atomic>
+#include <map>
+#include <mutex>
+
+#include "thread_info.h"
+
+using namespace NTrace;
+
+namespace
+{
+
+std::atomic<int> s_pid (0);
+/// Thread ID of the calling thread; 0 until first asked for
+thread_local int t_tid = 0;
+
+/**
+  \brief Registered thread names, by thread ID
+
+  Allocated once and never freed, so names can still be looked up while static
+  objects are destroyed.
+ */
+struct NameTable
+{
+  std::mutex mutex;
+  std::map<int, std::string> names;
+};
+
+NameTable &nameTable ()
+{
+  static NameTable *table = new NameTable;
+  return *table;
+}
+
+/// Ask the system for the ID of the calling thread
+int systemThreadId ()
+{
+#if defined(_WIN32)
+  return (int)::GetCurrentThreadId ();
+#elif defined(__linux__)
+  return (int)syscall (SYS_gettid);
+#elif defined(__APPLE__)
+  uint64_t id = 0;
+  pthread_threadid_np (nullptr, &id);
+  return (int)id;
+#else
+  return (int)(intptr_t)pthread_self ();
+#endif
+}
+
+int systemProcessId ()
+{
+#if defined(_WIN32)
+  return (int)::GetCurrentProcessId ();
+#else
+  return (int)getpid ();
+#endif
+}
+
+#if !defined(_WIN32)
+/// Runs in the child after fork(); its only thread is a copy of the forking thread
+void afterFork ()
+{
+  s_pid.store (systemProcessId (), std::memory_order_relaxed);
+  t_tid = systemThreadId ();
+}
+#endif
+
+/// Fetch the process ID and make sure it is kept up to date
+bool initProcessId ()
+{
+  s_pid.store (systemProcessId (), std::memory_order_relaxed);
+#if !defined(_WIN32)
+  pthread_atfork (nullptr, nullptr, afterFork);
+#endif
+  return true;
+}
+
+} // namespace
+
+/**
+  \brief Return the ID of the current process, without a system call
+ */
+int ThreadInfo::getProcessId ()
+{
+  static bool initialized = initProcessId ();
+  (void)initialized;
+  return s_pid.load (std::memory_order_relaxed);
+}
+
+/**
+  \brief Return the ID of the calling thread
+
+  Only the first call in each thread asks the system.
+ */
+int ThreadInfo::getThreadId ()
+{
+  if (0 == t_tid)
+  {
+    t_tid = systemThreadId ();
+    // Thread IDs are reused; a new thread must not inherit the name of an old one
+    NameTable &table = nameTable ();
+    std::lock_guard<std::mutex> lock (table.mutex);
+    table.names.erase (t_tid);
+  }
+  return t_tid;
+}
+
+/**
+  \brief Give the calling thread a name
+  \param name The name; an empty name removes it
+
+  On Linux the name is also passed to the system (truncated to 15 characters), so
+  it shows up in top, gdb and perf as well.
+ */
+void ThreadInfo::setThreadName (const std::string &name)
+{
+  int tid = getThreadId ();
+  {
+    NameTable &table = nameTable ();
+    std::lock_guard<std::mutex> lock (table.mutex);
+    if (name.empty ())
+    {
+      table.names.erase (tid);
+    }
+    else
+    {
+      table.names[tid] = name;
+    }
+  }
+#if defined(__linux__)
+  pthread_setname_np (pthread_self (), name.substr (0, 15).c_str ());
+#endif
+}
+
+/**
+  \brief Return the name of a thread
+  \param tid Thread ID, as found in Message::tid
+  \return The name, or an empty string if the thread has no name
+ */
+std::string ThreadInfo::getThreadName (int tid)
+{
+  NameTable &table = nameTable ();
+  std::lock_guard<std::mutex> lock (table.mutex);
+  std::map<int, std::string>::const_iterator it = table.names.find (tid);
+  if (it == table.names.end ())
+  {
+    return std::string ();
+  }
+  return it->second;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+
+namespace NTrace
+{
+
+/**
+  \brief Cached identity of the process and the calling thread
+
+  Every message records the process and thread it came from. Asking the system
+  for those each time costs a system call, so they are looked up once and kept:
+  the process ID in a global that is refreshed in the child after fork(), the
+  thread ID in thread-local storage.
+
+  On Linux the thread ID is the kernel TID (as returned by gettid()), which is
+  the number that top, perf and /proc show.
+
+  Threads can be given a name; outputs can look it up by thread ID.
+*/
+class ThreadInfo
+{
+public:
+  static int getProcessId ();
+  static int getThreadId ();
+
+  static void setThreadName (const std::string &name);
+  static std::string getThreadName (int tid);
+};
+
+} // namespace
@@ -4,6 +4,7 @@
 
 #ifdef HAVE_SYS_TIME_H
 #include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 #endif
 
@@ -11,52 +12,114 @@
 
 using namespace NTrace;
 
-/**
-\brief Timestamp for 'now'
+namespace
+{
 
-Creates a Timestamp with the current time.
+const int64_t s_nanosPerSecond = 1000000000;
 
-*/
-Timestamp::Timestamp ()
+int64_t readClock (Timestamp::Domain domain)
 {
 #ifdef _WIN32
+  if (Timestamp::Monotonic == domain)
+  {
+    LARGE_INTEGER count, frequency;
+
+    ::QueryPerformanceCounter (&count);
+    ::QueryPerformanceFrequency (&frequency);
+    return (int64_t)(count.QuadPart / frequency.QuadPart) * s_nanosPerSecond +
+      (int64_t)(count.QuadPart % frequency.QuadPart) * s_nanosPerSecond / frequency.QuadPart;
+  }
+
   FILETIME ft;
   ULARGE_INTEGER ui;
 
   // Tick. 'File time' is some big-ass integer that counts in 100ns intervals since 1601 (Kepler would have killed to get such an accurate clock)
   ::GetSystemTimeAsFileTime (&ft);
-  // Tock. Convert to ULARGE_INTEGER 
+  // Tock. Convert to ULARGE_INTEGER
   ui.LowPart = ft.dwLowDateTime;
   ui.HighPart = ft.dwHighDateTime;
-  // Divide by 10 to go from 100ns to microseconds
-  uint64_t us = ui.QuadPart / 10L;
-  // Subtract epoch to reach Jan 1, 1970. (found on stackoverflow.com)
-  us -= 11644473600000000LL;
-
-  m_micro = us % 1000000;
-  m_time = (uint32_t)(us / 1000000);
+  // Subtract epoch to reach Jan 1, 1970. (found on stackoverflow.com), then go from 100ns to ns
+  return ((int64_t)ui.QuadPart - 116444736000000000LL) * 100;
+#elif defined(HAVE_SYS_TIME_H)
+  struct timespec ts;
+
+  clock_gettime ((Timestamp::Monotonic == domain) ? CLOCK_MONOTONIC : CLOCK_REALTIME, &ts);
+  return (int64_t)ts.tv_sec * s_nanosPerSecond + ts.tv_nsec;
+#else
+#error System not supported: no clock_gettime() or Windows clock.
 #endif
-#ifdef HAVE_SYS_TIME_H
-  struct timeval tv;
+}
 
-  gettimeofday (&tv, 0);
-  m_time = tv.tv_sec;
-  m_micro = tv.tv_usec;
-#endif
+} // namespace
+
+/**
+\brief Timestamp for 'now'
+
+Creates a Timestamp with the current wall clock time.
+
+*/
+Timestamp::Timestamp ()
+  : m_nanos (readClock (Realtime)), m_domain (Realtime)
+{
 }
 
 /**
  \brief Create Timestamp with pre-set time
  \param time Time in seconds since epoch
- \param micro Sub-microsecond part of timestam[p
+ \param micro Sub-second part of timestamp, in microseconds
  */
 
 Timestamp::Timestamp (uint32_t time, uint32_t micro)
+  : m_nanos ((int64_t)time * s_nanosPerSecond + (int64_t)micro * 1000), m_domain (Realtime)
+{
+}
+
+/**
+ \brief Return the current time of one of the clocks
+ \param domain Realtime or Monotonic
+ */
+Timestamp Timestamp::now (Domain domain)
+{
+  return fromNanos (readClock (domain), domain);
+}
+
+/**
+ \brief Create Timestamp from a number of nanoseconds
+ */
+Timestamp Timestamp::fromNanos (int64_t nanos, Domain domain)
+{
+  Timestamp ts (0, 0);
+  ts.m_nanos = nanos;
+  ts.m_domain = domain;
+  return ts;
+}
+
+/**
+ \brief Create raw Timestamp
+ \param ticks Value of the CPU time stamp counter
+
+ The result must be converted with a TscCalibration before it can be used.
+ */
+Timestamp Timestamp::fromTicks (uint64_t ticks)
 {
-  m_time = time;
-  m_micro = micro;
+  return fromNanos ((int64_t)ticks, Ticks);
 }
 
+/**
+\brief Return the wall clock time of this timestamp
+
+A monotonic timestamp is converted with the current difference between the two
+clocks, so the result follows any adjustments made to the system clock since.
+*/
+Timestamp Timestamp::toRealtime () const
+{
+  if (Monotonic != m_domain)
+  {
+    return *this;
+  }
+  int64_t offset = readClock (Realtime) - readClock (Monotonic);
+  return fromNanos (m_nanos + offset, Realtime);
+}
 
 /**
 \brief Return seconds part of timestamp
@@ -64,7 +127,7 @@ Timestamp::Timestamp (uint32_t time, uint32_t micro)
 
 uint32_t Timestamp::getTime () const
 {
-  return m_time;
+  return (uint32_t)(m_nanos / s_nanosPerSecond);
 }
 
 /**
@@ -72,25 +135,33 @@ uint32_t Timestamp::getTime () const
 */
 uint32_t Timestamp::getMicros () const
 {
-  return m_micro;
+  return getNanosPart () / 1000;
 }
 /**
-\brief Return milliseconds part of timestamp (derived from microseconds)
+\brief Return milliseconds part of timestamp
 */
 
 uint32_t Timestamp::getMillis () const
 {
-  return m_micro / 1000;
+  return getNanosPart () / 1000000;
 }
 
 /**
-\brief Return timestamp as a fractional number.
+\brief Return nanoseconds part of timestamp
+*/
+uint32_t Timestamp::getNanosPart () const
+{
+  return (uint32_t)(m_nanos % s_nanosPerSecond);
+}
 
+/**
+\brief Return timestamp as a fractional number.
 
+Only use this for display; the conversion to double loses precision.
 */
 double Timestamp::getFraction () const
 {
-  return m_time + m_micro / 1e6;
+  return m_nanos / 1e9;
 }
 
 /**
@@ -98,37 +169,51 @@ double Timestamp::getFraction () const
  \param since Timestamp to calculate to
 
  Returns the difference between the current timestamp and \p since as a fractional
- number. If \p since is in the past, returns a positive number.
-
-
+ number of seconds. If \p since is in the past, returns a positive number.
+ The operator -() returns the exact difference in nanoseconds.
  */
 double Timestamp::getDifference (const Timestamp &since) const
 {
-  return getFraction () - since.getFraction ();
+  return (*this - since) / 1e9;
 }
 
-
-Timestamp &Timestamp::operator =(const Timestamp &src)
+bool Timestamp::operator ==(const Timestamp &eq) const
 {
-  m_time = src.m_time;
-  m_micro = src.m_micro;
-  return *this;
+  return m_nanos == eq.m_nanos && m_domain == eq.m_domain;
 }
 
-bool Timestamp::operator ==(const Timestamp &eq)
+bool Timestamp::operator !=(const Timestamp &ne) const
 {
-  return m_time == eq.m_time  && m_micro == eq.m_micro;
+  return !(*this == ne);
 }
 
-bool Timestamp::operator <(const Timestamp &lt)
+/**
+ Timestamps from different domains are compared by their wall clock time.
+ */
+bool Timestamp::operator <(const Timestamp &lt) const
 {
-  if (m_time < lt.m_time)
+  if (m_domain == lt.m_domain)
   {
-    return true;
+    return m_nanos < lt.m_nanos;
   }
-  if (m_time == lt.m_time && m_micro < lt.m_micro)
+  return toRealtime ().m_nanos < lt.toRealtime ().m_nanos;
+}
+
+bool Timestamp::operator >(const Timestamp &gt) const
+{
+  return gt < *this;
+}
+
+/**
+ \brief Return the difference in nanoseconds
+
+ Timestamps from different domains are subtracted by their wall clock time.
+ */
+int64_t Timestamp::operator -(const Timestamp &since) const
+{
+  if (m_domain == since.m_domain)
   {
-    return true;
+    return m_nanos - since.m_nanos;
   }
-  return false;
+  return toRealtime ().m_nanos - since.toRealtime ().m_nanos;
 }
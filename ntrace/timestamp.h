@@ -7,35 +7,84 @@
 namespace NTrace
 {
 /**
-\brief Represent timestamp with microsecond precision
+\brief Represent timestamp with nanosecond precision
 
-This class represents a timestamp as seconds and microseconds in UTC; the microsecond
-precision depends on the underlying operating system of course.
+This class represents a timestamp as a 64-bit number of nanoseconds in one of two
+domains:
+- Realtime: the wall clock (CLOCK_REALTIME), counted from the epoch in UTC
+- Monotonic: a clock that never jumps (CLOCK_MONOTONIC), counted from some unspecified point
 
-It also performs simple arithmetic to compare and subtract timestamps.
+Messages are stamped with monotonic time, so the difference between two messages
+is not affected when the system clock is adjusted; use toRealtime() to find out
+the wall clock time. The actual precision depends on the operating system of course.
+
+It also performs simple arithmetic to compare and subtract timestamps, all with
+integers.
+
+A timestamp can also be 'raw': it then only holds a value of the CPU time stamp
+counter, which still has to be converted to a real time (see Clock). The manager
+does that before messages reach the outputs.
 */
 class NTRACE_EXPORT Timestamp
 {
 public:
+  /// Clock the value was read from
+  enum Domain
+  {
+    Realtime,
+    Monotonic,
+    Ticks       ///< Raw TSC value
+  };
+
   Timestamp ();
   Timestamp (uint32_t time, uint32_t micro);
 
+  static Timestamp NTRACE_CALL now (Domain domain);
+  static Timestamp NTRACE_CALL fromNanos (int64_t nanos, Domain domain);
+  static Timestamp NTRACE_CALL fromTicks (uint64_t ticks);
+
+  /// Returns the clock this timestamp was read from
+  Domain getDomain () const
+  {
+    return m_domain;
+  }
+  /// Returns the time in nanoseconds (the TSC value for a raw timestamp)
+  int64_t getNanos () const
+  {
+    return m_nanos;
+  }
+  /// Returns true if this is a TSC value that has not been converted yet
+  bool isRaw () const
+  {
+    return Ticks == m_domain;
+  }
+  /// Returns the TSC value of a raw timestamp
+  uint64_t getTicks () const
+  {
+    return (uint64_t)m_nanos;
+  }
+
+  Timestamp NTRACE_CALL toRealtime () const;
+
   uint32_t NTRACE_CALL getTime () const;
   uint32_t NTRACE_CALL getMicros () const;
   uint32_t NTRACE_CALL getMillis () const;
+  uint32_t NTRACE_CALL getNanosPart () const;
 
   double NTRACE_CALL getFraction () const;
   double NTRACE_CALL getDifference (const Timestamp &since) const;
 
   // operator overloads.
-  Timestamp & NTRACE_CALL operator =(const Timestamp &src);
-  bool NTRACE_CALL operator ==(const Timestamp &eq);
-  bool NTRACE_CALL operator <(const Timestamp &lt);
+  bool NTRACE_CALL operator ==(const Timestamp &eq) const;
+  bool NTRACE_CALL operator !=(const Timestamp &ne) const;
+  bool NTRACE_CALL operator <(const Timestamp &lt) const;
+  bool NTRACE_CALL operator >(const Timestamp &gt) const;
+  int64_t NTRACE_CALL operator -(const Timestamp &since) const;
 
 private:
-  uint32_t m_time;
-  uint32_t m_micro;
+  int64_t m_nanos;
+  Domain m_domain;
 };
 
 
-} // namespace
\ No newline at end of file
+} // namespace
@@ -0,0 +1,452 @@
+/**
+  ntrace-decode: convert a file written by BinaryFileOutput to text or JSON
+
+  Usage: ntrace-decode [-j] [file]
+
+  -j : write one JSON object per message (JSON Lines) instead of text
+
+  Without a file, or with '-', the binary log is read from standard input. The
+  text layout is the same as that of FileOutput.
+ */
+
+#if defined(_WIN32)
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../ntrace/binary_format.h"
+#include "../ntrace/message.h"
+
+using namespace NTrace;
+
+namespace
+{
+
+const size_t s_readSize = 4 * 1024 * 1024;
+const size_t s_writeSize = 1024 * 1024;
+
+/// Everything we know while going through a file
+class Decoder
+{
+public:
+  Decoder (bool json)
+    : m_json (json), m_clockOffset (0), m_lastNanos (0), m_cachedSecond (-1)
+  {
+  }
+
+  size_t decode (const unsigned char *begin, const unsigned char *end, bool &error);
+  void flush (bool force);
+
+private:
+  bool decodeRecord (int type, const unsigned char *p, const unsigned char *end);
+  bool decodeMessage (const unsigned char *p, const unsigned char *end);
+  void writeText (int pid, int type, uint64_t function, const unsigned char *text, size_t length);
+  void writeJson (int pid, int tid, int level, int type, uint64_t module, uint64_t function, const unsigned char *text, size_t length);
+  void appendJsonString (const char *text, size_t length);
+
+  bool m_json;
+  std::string m_out;
+
+  int64_t m_clockOffset;
+  int64_t m_lastNanos;
+  int64_t m_wallclock; ///< Wall clock time of the current message
+
+  std::unordered_map<uint64_t, std::string> m_modules;
+  std::unordered_map<uint64_t, std::string> m_functions;
+  std::unordered_map<uint64_t, std::string> m_threads; ///< Key is pid << 32 | tid
+
+  int64_t m_cachedSecond;   ///< Second for which m_cachedTime holds the text
+  std::string m_cachedTime; ///< "[YYYY-MM-DD HH:MM:SS"
+};
+
+/**
+  \brief Decode as many complete records as there are in the data
+  \return Number of bytes used; the rest is the start of an incomplete record
+ */
+size_t Decoder::decode (const unsigned char *begin, const unsigned char *end, bool &error)
+{
+  const unsigned char *p = begin;
+  error = false;
+  while (p < end)
+  {
+    const unsigned char *record = p;
+    uint64_t length = 0;
+    if (!BinaryFormat::getVarint (p, end, length) || (uint64_t)(end - p) < length)
+    {
+      // Incomplete; wait for more data
+      return record - begin;
+    }
+    if (0 == length || !decodeRecord (*p, p + 1, p + length))
+    {
+      error = true;
+      return record - begin;
+    }
+    p += length;
+    flush (false);
+  }
+  return p - begin;
+}
+
+bool Decoder::decodeRecord (int type, const unsigned char *p, const unsigned char *end)
+{
+  uint64_t id = 0;
+  switch (type)
+  {
+    case BinaryFormat::ClockRecord:
+      return BinaryFormat::getSigned (p, end, m_clockOffset);
+
+    case BinaryFormat::ModuleRecord:
+      if (!BinaryFormat::getVarint (p, end, id))
+      {
+        return false;
+      }
+      m_modules[id].assign ((const char *)p, end - p);
+      return true;
+
+    case BinaryFormat::FunctionRecord:
+      if (!BinaryFormat::getVarint (p, end, id))
+      {
+        return false;
+      }
+      m_functions[id].assign ((const char *)p, end - p);
+      return true;
+
+    case BinaryFormat::ThreadRecord:
+    {
+      uint64_t pid = 0;
+      uint64_t tid = 0;
+      if (!BinaryFormat::getVarint (p, end, pid) || !BinaryFormat::getVarint (p, end, tid))
+      {
+        return false;
+      }
+      m_threads[(pid << 32) | tid].assign ((const char *)p, end - p);
+      return true;
+    }
+
+    case BinaryFormat::MessageRecord:
+      return decodeMessage (p, end);
+
+    default:
+      // Written by a newer version; skip it
+      return true;
+  }
+}
+
+bool Decoder::decodeMessage (const unsigned char *p, const unsigned char *end)
+{
+  int64_t delta = 0;
+  uint64_t pid = 0;
+  uint64_t tid = 0;
+  int64_t level = 0;
+  uint64_t type = 0;
+  uint64_t module = 0;
+  uint64_t function = 0;
+  if (!BinaryFormat::getSigned (p, end, delta) ||
+    !BinaryFormat::getVarint (p, end, pid) ||
+    !BinaryFormat::getVarint (p, end, tid) ||
+    !BinaryFormat::getSigned (p, end, level) ||
+    !BinaryFormat::getVarint (p, end, type) ||
+    !BinaryFormat::getVarint (p, end, module) ||
+    !BinaryFormat::getVarint (p, end, function))
+  {
+    return false;
+  }
+  m_lastNanos += delta;
+  m_wallclock = m_lastNanos + m_clockOffset;
+
+  if (m_json)
+  {
+    writeJson ((int)pid, (int)tid, (int)level, (int)type, module, function, p, end - p);
+  }
+  else
+  {
+    writeText ((int)pid, (int)type, function, p, end - p);
+  }
+  return true;
+}
+
+/**
+  \brief Write a message in the layout of FileOutput
+ */
+void Decoder::writeText (int pid, int type, uint64_t function, const unsigned char *text, size_t length)
+{
+  char buf[32];
+  if (pid >= 0 && pid < 100000)
+  {
+    // Same as "(%5d) ", without the cost of snprintf()
+    char *p = buf + 8;
+    *--p = ' ';
+    *--p = ')';
+    int value = pid;
+    do
+    {
+      *--p = '0' + value % 10;
+      value /= 10;
+    } while (value > 0);
+    while (p > buf + 1)
+    {
+      *--p = ' ';
+    }
+    *--p = '(';
+    m_out.append (buf, 8);
+  }
+  else
+  {
+    snprintf (buf, sizeof (buf), "(%5d) ", pid);
+    m_out += buf;
+  }
+
+  int64_t second = m_wallclock / 1000000000;
+  int millis = (int)(m_wallclock % 1000000000 / 1000000);
+  if (second != m_cachedSecond)
+  {
+    time_t st = (time_t)second;
+    struct tm *when = gmtime (&st);
+    if (nullptr == when)
+    {
+      m_cachedTime = "[\?\?\?\?-\?\?-\?\? \?\?:\?\?:\?\?";
+    }
+    else
+    {
+      strftime (buf, sizeof (buf), "[%Y-%m-%d %H:%M:%S", when);
+      m_cachedTime = buf;
+    }
+    m_cachedSecond = second;
+  }
+  m_out += m_cachedTime;
+  buf[0] = '.';
+  buf[1] = '0' + millis / 100;
+  buf[2] = '0' + millis / 10 % 10;
+  buf[3] = '0' + millis % 10;
+  buf[4] = ']';
+  buf[5] = ' ';
+  m_out.append (buf, 6);
+
+  std::unordered_map<uint64_t, std::string>::const_iterator name = m_functions.end ();
+  if ((Message::Entry == type || Message::Exit == type) && function != 0)
+  {
+    name = m_functions.find (function);
+  }
+  if (name != m_functions.end ())
+  {
+    m_out += name->second;
+    if (Message::Entry == type && length > 0)
+    {
+      m_out += " (";
+      m_out.append ((const char *)text, length);
+      m_out += ")";
+    }
+  }
+  else
+  {
+    m_out.append ((const char *)text, length);
+  }
+  m_out += '\n';
+}
+
+void Decoder::writeJson (int pid, int tid, int level, int type, uint64_t module, uint64_t function, const unsigned char *text, size_t length)
+{
+  char buf[128];
+  snprintf (buf, sizeof (buf), "{\"ts\":%lld,\"pid\":%d,\"tid\":%d,\"level\":%d,\"type\":", (long long)m_wallclock, pid, tid, level);
+  m_out += buf;
+  switch (type)
+  {
+    case Message::Normal:
+      m_out += "\"normal\"";
+      break;
+    case Message::Out:
+      m_out += "\"out\"";
+      break;
+    case Message::Error:
+      m_out += "\"error\"";
+      break;
+    case Message::Entry:
+      m_out += "\"entry\"";
+      break;
+    case Message::Exit:
+      m_out += "\"exit\"";
+      break;
+    default:
+      snprintf (buf, sizeof (buf), "%d", type);
+      m_out += buf;
+      break;
+  }
+
+  std::unordered_map<uint64_t, std::string>::const_iterator it = m_threads.find (((uint64_t)(uint32_t)pid << 32) | (uint32_t)tid);
+  if (it != m_threads.end ())
+  {
+    m_out += ",\"thread\":";
+    appendJsonString (it->second.data (), it->second.size ());
+  }
+  it = m_modules.find (module);
+  if (module != 0 && it != m_modules.end ())
+  {
+    m_out += ",\"module\":";
+    appendJsonString (it->second.data (), it->second.size ());
+  }
+  it = m_functions.find (function);
+  if (function != 0 && it != m_functions.end ())
+  {
+    m_out += ",\"function\":";
+    appendJsonString (it->second.data (), it->second.size ());
+  }
+  m_out += ",\"message\":";
+  appendJsonString ((const char *)text, length);
+  m_out += "}\n";
+}
+
+void Decoder::appendJsonString (const char *text, size_t length)
+{
+  m_out += '"';
+  for (size_t i = 0; i < length; i++)
+  {
+    unsigned char c = text[i];
+    if ('"' == c || '\\' == c)
+    {
+      m_out += '\\';
+      m_out += (char)c;
+    }
+    else if (c < 0x20)
+    {
+      char esc[8];
+      snprintf (esc, sizeof (esc), "\\u%04x", c);
+      m_out += esc;
+    }
+    else
+    {
+      m_out += (char)c;
+    }
+  }
+  m_out += '"';
+}
+
+/**
+  \brief Write the output buffer to stdout once it is large enough, or when \p force is set
+ */
+void Decoder::flush (bool force)
+{
+  if (m_out.size () >= s_writeSize || (force && !m_out.empty ()))
+  {
+    fwrite (m_out.data (), 1, m_out.size (), stdout);
+    m_out.clear ();
+  }
+}
+
+void help (const char *msg)
+{
+  if (msg)
+  {
+    fprintf (stderr, "%s\n", msg);
+  }
+  fprintf (stderr, "Usage: ntrace-decode [-j] [file]\n");
+  fprintf (stderr, "  Converts a binary log file written by BinaryFileOutput to text.\n");
+  fprintf (stderr, "  -j    Write one JSON object per message instead.\n");
+  fprintf (stderr, "  Without a file, or with '-', standard input is read.\n");
+}
+
+} // namespace
+
+int main (int argc, char *argv[])
+{
+  bool json = false;
+  const char *filename = nullptr;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (0 == strcmp (argv[i], "-j"))
+    {
+      json = true;
+    }
+    else if (0 == strcmp (argv[i], "-h") || 0 == strcmp (argv[i], "--help"))
+    {
+      help (nullptr);
+      return 0;
+    }
+    else if (nullptr == filename)
+    {
+      filename = argv[i];
+    }
+    else
+    {
+      help ("Too many arguments");
+      return 1;
+    }
+  }
+
+  FILE *in = stdin;
+  if (filename && strcmp (filename, "-") != 0)
+  {
+    in = fopen (filename, "rb");
+    if (nullptr == in)
+    {
+      fprintf (stderr, "ntrace-decode: cannot open %s\n", filename);
+      return 1;
+    }
+  }
+
+  std::vector<unsigned char> data (s_readSize);
+  size_t have = fread (&data[0], 1, data.size (), in);
+  if (have < BinaryFormat::s_magicLength + 1 ||
+    memcmp (&data[0], BinaryFormat::magic (), BinaryFormat::s_magicLength) != 0)
+  {
+    fprintf (stderr, "ntrace-decode: not an NTrace binary log\n");
+    return 1;
+  }
+  if (data[BinaryFormat::s_magicLength] > BinaryFormat::s_version)
+  {
+    fprintf (stderr, "ntrace-decode: unsupported version %d\n", data[BinaryFormat::s_magicLength]);
+    return 1;
+  }
+
+  Decoder decoder (json);
+  size_t start = BinaryFormat::s_magicLength + 1;
+  int ret = 0;
+  for (;;)
+  {
+    bool error = false;
+    size_t used = decoder.decode (&data[start], &data[0] + have, error);
+    start += used;
+    if (error)
+    {
+      fprintf (stderr, "ntrace-decode: corrupt record\n");
+      ret = 1;
+      break;
+    }
+
+    // Keep the incomplete record and read more behind it
+    size_t left = have - start;
+    memmove (&data[0], &data[start], left);
+    start = 0;
+    have = left;
+    if (have == data.size ())
+    {
+      // A single record larger than the buffer
+      data.resize (data.size () * 2);
+    }
+    size_t got = fread (&data[have], 1, data.size () - have, in);
+    if (0 == got)
+    {
+      if (have > 0)
+      {
+        fprintf (stderr, "ntrace-decode: the last record is incomplete\n");
+      }
+      break;
+    }
+    have += got;
+  }
+
+  decoder.flush (true);
+  if (in != stdin)
+  {
+    fclose (in);
+  }
+  return ret;
+}